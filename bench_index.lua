@@ -0,0 +1,107 @@
+-- Benchmark of entity index : lua bench_index.lua [n], n = 1000000 by default
+-- Build with ECS_INDEX32 (make index32) to compare the 4 bytes index with the packed 3 bytes one.
+local ecs = require "ecs"
+
+local N = tonumber(arg and arg[1]) or 1000000
+
+local w = ecs.world()
+
+w:register {
+	name = "a",
+	type = "int",
+}
+
+w:register {
+	name = "b",
+	type = "int",
+}
+
+w:register {
+	name = "c",
+	"x:float",
+	"y:float",
+}
+
+w:register {
+	name = "t",
+}
+
+local function bench(name, f)
+	local t = os.clock()
+	local r = f()
+	print(string.format("%-12s %8.3f s", name, os.clock() - t), r or "")
+end
+
+local eids = {}
+
+bench("new", function()
+	for i = 1, N do
+		eids[i] = w:new {
+			a = i,
+			b = (i % 3 == 0) and i or nil,
+			c = (i % 7 == 0) and { x = i, y = i } or nil,
+			t = (i % 5 == 0),
+		}
+	end
+end)
+
+bench("join", function()
+	local s = 0
+	for _ = 1, 3 do
+		for e in w:select "b:in a:in c?in t?in" do
+			s = s + e.a
+		end
+	end
+	return s
+end)
+
+bench("filter", function()
+	w:filter("t", "a c b:absent")
+	return w:count "t"
+end)
+
+bench("access", function()
+	local s = 0
+	for i = 3, N, 3 do
+		s = s + w:access(eids[i], "b")
+	end
+	return s
+end)
+
+bench("update", function()
+	for i = 1, N, 20 do
+		w:remove(eids[i])
+	end
+	w:update()
+	return w:count "a"
+end)
+
+-- random eids after the removals, the lookups don't follow the order of entities
+math.randomseed(N)
+local random = {}
+for i = 1, 1000000 do
+	random[i] = eids[math.random(N)]
+end
+
+bench("exist", function()
+	local n = 0
+	for i = 1, #random do
+		if w:exist(random[i]) then
+			n = n + 1
+		end
+	end
+	return n
+end)
+
+bench("random", function()
+	local s = 0
+	for i = 1, #random do
+		local eid = random[i]
+		if w:exist(eid) then
+			s = s + w:access(eid, "a")
+		end
+	end
+	return s
+end)
+
+print("memory", w:memory())
@@ -0,0 +1,84 @@
+-- Benchmark of disabling tags : lua bench_tag.lua [n]
+local ecs = require "ecs"
+
+local N = tonumber(arg and arg[1]) or 200000
+
+local w = ecs.world()
+
+w:register {
+	name = "a",
+	type = "int",
+}
+
+w:register {
+	name = "t",
+}
+
+local function bench(name, f)
+	local t = os.clock()
+	local r = f()
+	print(string.format("%-12s %8.3f s", name, os.clock() - t), r or "")
+end
+
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new {
+		a = i,
+		t = true,
+	}
+end
+
+bench("disable", function()
+	-- disable the first half in the iteration, it's a long run of disabled tags
+	for e in w:select "t:update a:in" do
+		if e.a <= N // 2 or e.a % 3 == 0 then
+			e.t = false
+		end
+	end
+	return w:count "t"
+end)
+
+bench("iterate", function()
+	local s = 0
+	for _ = 1, 3 do
+		for e in w:select "t a:in" do
+			s = s + e.a
+		end
+	end
+	return s
+end)
+
+bench("access", function()
+	-- disable backward
+	for i = N, 1, -7 do
+		w:access(eids[i], "t", false)
+	end
+	return w:count "t"
+end)
+
+bench("enable", function()
+	for i = 1, N, 2 do
+		w:access(eids[i], "t", true)
+	end
+	return w:count "t"
+end)
+
+bench("update", function()
+	for e in w:select "t:update a:in" do
+		if e.a % 5 == 0 then
+			e.t = false
+		end
+	end
+	w:update()
+	return w:count "t"
+end)
+
+bench("iterate", function()
+	local s = 0
+	for _ = 1, 3 do
+		for e in w:select "t a:in" do
+			s = s + e.a
+		end
+	end
+	return s
+end)
@@ -48,6 +48,10 @@ local function get_attrib(opt, inout)
 	elseif inout == "absent" then
 		desc.absent = true
 		assert(not desc.opt)
+	elseif inout == "changed" then
+		desc.r = true
+		desc.changed = true
+		assert(not desc.opt)
 	else
 		assert(inout == "new")
 	end
@@ -83,6 +87,52 @@ local function get_inout(pat, name)
 	return optional, input, output
 end
 
+local pred_ops = {
+	["=="] = true,
+	["~="] = true,
+	["<"] = true,
+	["<="] = true,
+	[">"] = true,
+	[">="] = true,
+}
+
+-- "x>0,y<=1" for struct, "<10" for value type, "x>?" binds the value at select time
+local function gen_pred(tc, s, param)
+	assert(tc.size and tc.size > 0 and not tc.raw, "Predicate needs C component")
+	local pred = {}
+	for cond in s:gmatch "[^,]+" do
+		local field, op, value = cond:match "^([_%w]*)([<>=~]=?)([^<>=~]+)$"
+		assert(field and pred_ops[op], "Invalid predicate")
+		local f
+		if field == "" then
+			assert(tc.type, "Predicate needs a field")
+			f = tc[1]
+		else
+			for i = 1, #tc do
+				if tc[i][2] == field then
+					f = tc[i]
+					break
+				end
+			end
+			assert(f, "Unknown field " .. field)
+		end
+		local p
+		if value == "?" then
+			param = param + 1
+			p = param
+			value = 0
+		elseif value == "true" then
+			value = 1
+		elseif value == "false" then
+			value = 0
+		else
+			value = assert(math.tointeger(value) or tonumber(value), "Invalid predicate value")
+		end
+		pred[#pred+1] = { f[3], f[1], op, value, p }
+	end
+	return pred, param
+end
+
 local function cache_world(obj, k)
 	local c = {
 		typenames = {},
@@ -146,9 +196,15 @@ local function cache_world(obj, k)
 		local typenames = c.typenames
 		local desc = {}
 		local idx = 1
+		local param = 0
 		for token in pat:gmatch "[^ ]+" do
 			local key, padding = token:match "^([_%w]+)(.*)"
 			assert(key, "Invalid pattern")
+			local pred
+			if padding:sub(1, 1) == "[" then
+				pred, padding = padding:match "^%[(.-)%](.*)$"
+				assert(pred, "Invalid pattern")
+			end
 			local opt, inout
 			if padding ~= "" then
 				opt, inout = padding:match "^([:?])(%l+)$"
@@ -165,6 +221,9 @@ local function cache_world(obj, k)
 			a.name = tc.name
 			a.id = tc.id
 			a.type = tc.type
+			if pred then
+				a.pred, param = gen_pred(tc, pred, param)
+			end
 			local n = #tc
 			for i=1,#tc do
 				a[i] = tc[i]
@@ -175,10 +234,17 @@ local function cache_world(obj, k)
 		return desc
 	end
 
+	-- The matches are cached in the iterators, keep the recent ones from gc
+	local HOT_PATTERN = 64
+	local hot = {}
+	local hot_index = 0
+
 	local function cache_select(cache, pat)
 		local pat_desc = gen_select_pat(pat)
 		local p = k:_groupiter(pat_desc)
 		cache[pat] = p
+		hot_index = hot_index % HOT_PATTERN + 1
+		hot[hot_index] = p
 		return p
 	end
 
@@ -363,9 +429,47 @@ do	-- newtype
 				c.tag = true
 			end
 		end
+		if typeclass.changed then
+			assert(c.size > 0 and not c.raw, "Only C component can be changed")
+		end
+		local flags = 0
+		if typeclass.sparse then
+			flags = flags | ecs._SPARSE
+		end
+		local columns
+		if typeclass.layout == "soa" then
+			assert(c.size > 0 and not c.raw, "soa layout needs fields")
+			flags = flags | ecs._SOA
+			columns = {}
+			for i = 1, #c do
+				local f = c[i]
+				columns[i*2-1] = f[3]
+				columns[i*2] = typesize[f[1]]
+			end
+		else
+			assert(typeclass.layout == nil or typeclass.layout == "aos", "Invalid layout")
+		end
+		if typeclass.paged then
+			assert(c.size > 0 and columns == nil, "Only C component in aos layout can be paged")
+			flags = flags | ecs._PAGED
+		end
+		if typeclass.transient then
+			assert(ttype ~= "lua" and not typeclass.paged and not typeclass.sparse, "Transient component can't be lua object, paged or sparse")
+			flags = flags | ecs._TRANSIENT
+		end
+		if typeclass.bitset then
+			assert(c.tag and not typeclass.sparse and not typeclass.transient, "Only tag can be bitset, and it can't be sparse or transient")
+			flags = flags | ecs._BITSET
+		end
+		if typeclass.align then
+			assert(c.size > 0 and not c.raw, "Only C component can be aligned")
+		end
+		if typeclass.changed then
+			flags = flags | ecs._CHANGED
+		end
 		typenames[name] = c
 		ctx.typeidtoname[id] = name
-		self:_newtype(id, c.size)
+		self:_newtype(id, c.size, nil, flags, columns, typeclass.align)
 		return id, c.size
 	end
 end
@@ -437,6 +541,37 @@ function M:new(obj)
 	return eid
 end
 
+-- New n entities with the same components, the eids are continuous. returns the first eid
+local function check_batch(self, obj)
+	local typenames = context[self].typenames
+	for k, v in pairs(obj) do
+		local tc = typenames[k]
+		if tc and tc.size == ecs._LUAOBJECT then
+			-- the value is shared by all the entities of the batch, only the immutable ones
+			local t = type(v)
+			if tc.init or (t ~= "string" and t ~= "number" and t ~= "boolean") then
+				error ("Lua object " .. k .. " can't be in a batch")
+			end
+		end
+	end
+end
+
+function M:new_batch(n, obj)
+	assert(math.type(n) == "integer" and n >= 0, "Invalid batch size")
+	if n == 0 then
+		return
+	end
+	if obj then
+		check_batch(self, obj)
+	end
+	local eid, index = self:_newentity()
+	if obj then
+		_new_entity(self, index, obj)
+	end
+	self:_clone(index, n - 1)
+	return eid
+end
+
 function M:import(eid, obj)
 	local index = self:_indexentity(eid)
 	_new_entity(self, index, obj)
@@ -491,22 +626,27 @@ function M:template_destruct(temp)
 end
 
 local cpairs = M._pairs
-function M:select(pat)
-	return cpairs(context[self].select[pat])
-end
-
-function M:select2(pat1, pat2)
-	local selects = context[self].select
-	local f1, p1, v1 = cpairs(selects[pat1])
-	local f2, p2, v2 = cpairs(selects[pat2])
-	return function()
-		v1 = f1(p1, v1)
-		v2 = f2(p2, v2)
-		if v1 == nil then
-			assert(v2 == nil)
-			return
+local cbind = M._bind
+function M:select(pat, ...)
+	local p = context[self].select[pat]
+	if ... ~= nil then
+		cbind(p, ...)
+	end
+	return cpairs(p)
+end
+
+do
+	local cpairs_multi = M._pairs_multi
+	function M:select2(pat1, pat2, ...)
+		local selects = context[self].select
+		if ... == nil then
+			return cpairs_multi(selects[pat1], selects[pat2])
+		end
+		local iters = { selects[pat1], selects[pat2] }
+		for i = 1, select("#", ...) do
+			iters[i + 2] = selects[select(i, ...)]
 		end
-		return v1, v2
+		return cpairs_multi(table.unpack(iters))
 	end
 end
 
@@ -519,8 +659,34 @@ end
 
 do
 	local _count = M._count
-	function M:count(pat)
-		return _count(context[self].select[pat])
+	function M:count(pat, ...)
+		local p = context[self].select[pat]
+		if ... ~= nil then
+			cbind(p, ...)
+		end
+		return _count(p)
+	end
+end
+
+do
+	local _columns = M._columns
+	local _submit_columns = M._submit_columns
+	function M:columns(pat, t, ...)
+		local p = context[self].select[pat]
+		if ... ~= nil then
+			cbind(p, ...)
+		end
+		return _columns(p, t)
+	end
+	function M:submit_columns(pat, t)
+		return _submit_columns(context[self].select[pat], t)
+	end
+end
+
+do
+	local _query_stat = M._query_stat
+	function M:query_stat(pat)
+		return _query_stat(context[self].select[pat])
 	end
 end
 
@@ -576,12 +742,20 @@ M.generate_eid = persistence_methods.generate_eid
 do
 	local cfirst = M._first
 
-	function M:first(pattern)
-		return cfirst(self, context[self].select[pattern], {})
+	function M:first(pattern, ...)
+		local p = context[self].select[pattern]
+		if ... ~= nil then
+			cbind(p, ...)
+		end
+		return cfirst(self, p, {})
 	end
 
-	function M:check(pattern)
-		return cfirst(self, context[self].select[pattern])
+	function M:check(pattern, ...)
+		local p = context[self].select[pattern]
+		if ... ~= nil then
+			cbind(p, ...)
+		end
+		return cfirst(self, p)
 	end
 end
 
@@ -797,10 +971,37 @@ do
 		local ctx = context[self]
 		return cpropagate(self, ctx.typenames[c].id, ctx.typenames[tag].id)
 	end
+	local cpropagate_all = M._propagate_all
+	function M:propagate_all(c, tag)
+		local ctx = context[self]
+		return cpropagate_all(self, ctx.typenames[c].id, ctx.typenames[tag].id)
+	end
+end
+
+do
+	local ctagop = M._tag_op
+	-- the same as ECS_TAG_* in luaecs.h
+	local UNION <const> = 0
+	local INTERSECT <const> = 1
+	local SUBTRACT <const> = 2
+	local function ids(typenames, name, ...)
+		if name then
+			return typenames[name].id, ids(typenames, ...)
+		end
+	end
+	local function tag_op(op)
+		return function(self, dst, ...)
+			local typenames = context[self].typenames
+			return ctagop(self, op, typenames[dst].id, ids(typenames, ...))
+		end
+	end
+	M.tag_union = tag_op(UNION)
+	M.tag_intersect = tag_op(INTERSECT)
+	M.tag_subtract = tag_op(SUBTRACT)
 end
 
-function ecs.world(predefined)
-	local w = ecs._world(M)
+function ecs.world(predefined, option)
+	local w = ecs._world(M, option and option.stable, option and option.alloc)
 	local ctx = context[w]
 	ctx.typenames.REMOVED = {
 		name = "REMOVED",
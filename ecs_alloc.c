@@ -0,0 +1,148 @@
+#include "ecs_alloc.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Each block has a header before it, so we know the size for lua_Alloc (osize) and the category.
+#define HEADER_SIZE 16
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct alloc_header {
+	size_t size;
+	uint16_t offset;	// from the beginning of the raw block
+	uint16_t align;
+	uint16_t cat;
+};
+
+static inline struct alloc_header *
+header_(void *ptr) {
+	return (struct alloc_header *)((char *)ptr - sizeof(struct alloc_header));
+}
+
+void *
+ecs_malloc_aligned_(struct ecs_allocator *A, int cat, size_t sz, int align) {
+	if (align <= HEADER_SIZE)
+		align = 0;
+	char *raw = (char *)A->f(A->ud, NULL, 0, sz + HEADER_SIZE + align);
+	if (raw == NULL)
+		return NULL;
+	char *ptr = raw + HEADER_SIZE;
+	if (align) {
+		ptr = (char *)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+	}
+	struct alloc_header *h = header_(ptr);
+	h->size = sz;
+	h->offset = (uint16_t)(ptr - raw);
+	h->align = (uint16_t)align;
+	h->cat = (uint16_t)cat;
+	A->bytes[cat] += sz;
+	return ptr;
+}
+
+void *
+ecs_malloc_(struct ecs_allocator *A, int cat, size_t sz) {
+	return ecs_malloc_aligned_(A, cat, sz, 0);
+}
+
+void
+ecs_free_(struct ecs_allocator *A, void *ptr) {
+	if (ptr == NULL)
+		return;
+	struct alloc_header *h = header_(ptr);
+	A->bytes[h->cat] -= h->size;
+	A->f(A->ud, (char *)ptr - h->offset, h->size + HEADER_SIZE + h->align, 0);
+}
+
+void *
+ecs_realloc_(struct ecs_allocator *A, int cat, void *ptr, size_t sz) {
+	if (ptr == NULL)
+		return ecs_malloc_(A, cat, sz);
+	struct alloc_header *h = header_(ptr);
+	if (h->align) {
+		// the offset may change, so copy it
+		void *p = ecs_malloc_aligned_(A, cat, sz, h->align);
+		if (p == NULL)
+			return NULL;
+		memcpy(p, ptr, h->size < sz ? h->size : sz);
+		ecs_free_(A, ptr);
+		return p;
+	}
+	size_t osize = h->size;
+	int ocat = h->cat;
+	char *raw = (char *)A->f(A->ud, (char *)ptr - HEADER_SIZE, osize + HEADER_SIZE, sz + HEADER_SIZE);
+	if (raw == NULL)
+		return NULL;
+	ptr = raw + HEADER_SIZE;
+	h = header_(ptr);
+	h->size = sz;
+	h->cat = (uint16_t)cat;
+	A->bytes[ocat] -= osize;
+	A->bytes[cat] += sz;
+	return ptr;
+}
+
+struct ecs_arena_block {
+	struct ecs_arena_block *next;
+	size_t size;
+};
+
+static inline char *
+arena_data(struct ecs_arena_block *b) {
+	return (char *)b + HEADER_SIZE;
+}
+
+static void
+arena_new_block(struct ecs_allocator *A, size_t sz) {
+	struct ecs_arena_block *b = (struct ecs_arena_block *)ecs_malloc_(A, ECS_MEM_TRANSIENT, sz + HEADER_SIZE);
+	b->next = A->arena;
+	b->size = sz;
+	A->arena = b;
+	A->arena_used = 0;
+}
+
+void *
+ecs_arena_alloc_(struct ecs_allocator *A, size_t sz, int align) {
+	if (align < HEADER_SIZE)
+		align = HEADER_SIZE;
+	struct ecs_arena_block *b = A->arena;
+	if (b) {
+		uintptr_t base = (uintptr_t)arena_data(b);
+		uintptr_t ptr = (base + A->arena_used + align - 1) & ~(uintptr_t)(align - 1);
+		if (ptr + sz <= base + b->size) {
+			A->arena_used = ptr + sz - base;
+			return (void *)ptr;
+		}
+	}
+	size_t block_sz = b ? b->size * 2 : ARENA_BLOCK_SIZE;
+	if (block_sz < sz + align)
+		block_sz = sz + align;
+	arena_new_block(A, block_sz);
+	return ecs_arena_alloc_(A, sz, align);
+}
+
+void
+ecs_arena_free_(struct ecs_allocator *A) {
+	struct ecs_arena_block *b = A->arena;
+	while (b) {
+		struct ecs_arena_block *next = b->next;
+		ecs_free_(A, b);
+		b = next;
+	}
+	A->arena = NULL;
+	A->arena_used = 0;
+}
+
+// The blocks are merged into one, so it's O(1) when the usage is stable
+void
+ecs_arena_reset_(struct ecs_allocator *A) {
+	struct ecs_arena_block *b = A->arena;
+	A->arena_used = 0;
+	if (b == NULL || b->next == NULL)
+		return;
+	size_t sz = 0;
+	for (; b; b = b->next) {
+		sz += b->size;
+	}
+	ecs_arena_free_(A);
+	arena_new_block(A, sz);
+}
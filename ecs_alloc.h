@@ -0,0 +1,41 @@
+#ifndef LUA_ECS_ALLOC_H
+#define LUA_ECS_ALLOC_H
+
+#include <stddef.h>
+#include <lua.h>
+
+#define ECS_MEM_COMPONENT 0	// buffers (and ids) of components
+#define ECS_MEM_TAG 1	// ids of tags
+#define ECS_MEM_SPARSE 2	// reverse maps of sparse pools
+#define ECS_MEM_EID 3
+#define ECS_MEM_GROUP 4
+#define ECS_MEM_OTHER 5	// caches, columns and temporary buffers
+#define ECS_MEM_TRANSIENT 6	// the arena of transient components
+#define ECS_MEM_COUNT 7
+
+#define ECS_MAX_ALIGN 4096
+
+struct ecs_arena_block;
+
+// All the memory of a world comes from f, it's lua_Alloc of the lua state by default
+struct ecs_allocator {
+	lua_Alloc f;
+	void *ud;
+	size_t bytes[ECS_MEM_COUNT];
+	struct ecs_arena_block *arena;	// bump allocator, the current block is the first one
+	size_t arena_used;
+};
+
+void * ecs_malloc_(struct ecs_allocator *A, int cat, size_t sz);
+// align is 0 (default) or power of 2 <= ECS_MAX_ALIGN
+void * ecs_malloc_aligned_(struct ecs_allocator *A, int cat, size_t sz, int align);
+// ptr can be NULL, the alignment of ptr is kept
+void * ecs_realloc_(struct ecs_allocator *A, int cat, void *ptr, size_t sz);
+void ecs_free_(struct ecs_allocator *A, void *ptr);
+
+// Memory from arena can't be freed one by one, reset releases all of them
+void * ecs_arena_alloc_(struct ecs_allocator *A, size_t sz, int align);
+void ecs_arena_reset_(struct ecs_allocator *A);
+void ecs_arena_free_(struct ecs_allocator *A);
+
+#endif
@@ -19,9 +19,10 @@ struct ecs_cache {
 
 struct ecs_cache *
 ecs_cache_create(struct entity_world *w, int keys[], int n) {
-	if (n <= 1)
+	// the rows of a bitset tag are not continuous
+	if (n <= 1 || (keys[0] >= 0 && (w->c[keys[0]].flags & POOL_BITSET)))
 		return NULL;
-	struct ecs_cache * c = (struct ecs_cache *)malloc(sizeof(*c));
+	struct ecs_cache * c = (struct ecs_cache *)ecs_malloc_(&w->alloc, ECS_MEM_OTHER, sizeof(*c));
 	c->mainkey = keys[0];
 	c->keys_n = n - 1;
 	assert(c->mainkey >= 0);
@@ -47,19 +48,20 @@ void
 ecs_cache_release(struct ecs_cache *c) {
 	if (c == NULL)
 		return;
-	free(c->index);
-	free(c);
+	ecs_free_(&c->w->alloc, c->index);
+	ecs_free_(&c->w->alloc, c);
 }
 
 int
 ecs_cache_sync(struct ecs_cache *c) {
 	struct entity_world *w = c->w;
+	ecs_flush_(w);
 	struct component_pool *mainkey = &w->c[c->mainkey];
 	int n = mainkey->n;
 	if (n > c->cap) {
 		size_t sz = c->keys_n * mainkey->cap * sizeof(entity_index_t);
-		free(c->index);
-		c->index = (entity_index_t *)malloc(sz);
+		ecs_free_(&w->alloc, c->index);
+		c->index = (entity_index_t *)ecs_malloc_(&w->alloc, ECS_MEM_OTHER, sz);
 		c->cap = mainkey->cap;
 	}
 	c->n = n;
@@ -69,9 +71,8 @@ ecs_cache_sync(struct ecs_cache *c) {
 int
 ecs_cache_fetch_index(struct ecs_cache *c, int index, int cid) {
 	struct component_pool * mp = &c->w->c[c->mainkey];
-	if (index >= mp->n)
+	if (index >= mp->n || tomb_test(mp, index))
 		return -1;
-	assert(index < mp->n);
 	if (cid == c->mainkey) {
 		return index;
 	} else if (cid == ENTITYID_TAG) {
@@ -80,15 +81,15 @@ ecs_cache_fetch_index(struct ecs_cache *c, int index, int cid) {
 	}
 	struct ecs_token token;
 	token.id = (int)index_(mp->id[index]);
-	if (index >= c->n) {
+	struct component_pool * cp = &c->w->c[cid];
+	if (index >= c->n || (cp->flags & POOL_BITSET)) {
 		return entity_component_index_(c->w, token, cid);
 	}
-	struct component_pool * cp = &c->w->c[cid];
 	int offset = c->keys[cid];
 	assert(offset >= 0);
 	entity_index_t *hint = c->index + index * c->keys_n + offset;
 	uint32_t pos = index_(*hint);
-	if (pos < cp->n && ENTITY_INDEX_CMP(mp->id[index], cp->id[pos]) == 0) {
+	if (pos < cp->n && ENTITY_INDEX_CMP(mp->id[index], cp->id[pos]) == 0 && !tomb_test(cp, pos)) {
 		return pos;
 	}
 	int id = entity_component_index_hint_(c->w, token, cid, pos);
@@ -109,5 +110,7 @@ ecs_cache_fetch(struct ecs_cache *c, int index, int cid) {
 		return (void *)c->w->eid.id[id];
 	}
 	struct component_pool * cp = &c->w->c[cid];
+	if (cp->flags & POOL_SOA)
+		return DUMMY_PTR;
 	return get_ptr(cp, id);
 }
@@ -1,31 +1,18 @@
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 #include <lua.h>
 
 #include "ecs_capi.h"
 
 #include "ecs_internal.h"
 
-static void
-remove_dup(struct component_pool *c, int index) {
-	int i;
-	entity_index_t eid = c->id[index];
-	int to = index;
-	for (i = index + 1; i < c->n; i++) {
-		if (ENTITY_INDEX_CMP(c->id[i],eid)!=0) {
-			eid = c->id[i];
-			c->id[to] = eid;
-			++to;
-		}
-	}
-	c->n = to;
-}
-
+// The rows in [0, n), the staged components are not merged here, so it never moves the rows
 void *
 entity_fetch_(struct entity_world *w, int cid, int index, struct ecs_token *output) {
 	if (cid < 0) {
 		assert(cid == ENTITYID_TAG);
-		if (index >= w->eid.n)
+		if (index >= w->eid.n || entity_id_isfree(&w->eid, index))
 			return NULL;
 		if (output) {
 			output->id = index;
@@ -34,6 +21,13 @@ entity_fetch_(struct entity_world *w, int cid, int index, struct ecs_token *outp
 	}
 	struct component_pool *c = &w->c[cid];
 	assert(index >= 0);
+	if (c->flags & POOL_BITSET) {
+		// the token is set even if the tag is absent, see entity_join_begin
+		if (output) {
+			output->id = index;
+		}
+		return bitset_test(c, index) ? DUMMY_PTR : NULL;
+	}
 	if (index >= c->n)
 		return NULL;
 	if (output) {
@@ -42,60 +36,90 @@ entity_fetch_(struct entity_world *w, int cid, int index, struct ecs_token *outp
 	return get_ptr(c, index);
 }
 
+// entity_fetch of the C api, a struct of arrays can't be read by the pointer (DUMMY_PTR like a tag),
+// and a disabled tag is absent (the token is still set, see entity_join_begin).
+// The index of a bitset tag is the entity index, NULL if it's absent.
+// The staged components are the rows after n, see ecs_pool_flush_
+static void *
+fetch_row(struct entity_world *w, int cid, int index, struct ecs_token *output) {
+	if (cid >= 0) {
+		struct component_pool *c = &w->c[cid];
+		if (index >= c->n && index < c->n + c->pending) {
+			if (output) {
+				output->id = (int)index_(c->id[index]);
+			}
+			return (c->flags & POOL_SOA) ? DUMMY_PTR : get_ptr(c, index);
+		}
+	}
+	void *ptr = entity_fetch_(w, cid, index, output);
+	if (cid >= 0 && ptr) {
+		struct component_pool *c = &w->c[cid];
+		if (c->flags & POOL_SOA)
+			return DUMMY_PTR;
+		if (c->tomb_n > 0 && tomb_test(c, index))
+			return NULL;
+	}
+	return ptr;
+}
+
+// The rows of a bitset tag aren't dense, NULL is not the end. Iterate it by entity_next instead.
+void *
+entity_fetch_c_(struct entity_world *w, int cid, int index, struct ecs_token *output) {
+	if (cid >= 0 && (w->c[cid].flags & POOL_BITSET)) {
+		assert(!"entity_fetch of bitset tag");
+		return NULL;
+	}
+	return fetch_row(w, cid, index, output);
+}
+
+// For the workers, the staged components should be merged by entity_split, or the rows may move under them
+void *
+entity_fetch_r_(struct entity_world *w, int cid, int index, struct ecs_token *output) {
+	assert(cid < 0 || w->c[cid].pending == 0);
+	return fetch_row(w, cid, index, output);
+}
+
 int
 entity_next_tag_(struct entity_world *w, int tag_id, int index, struct ecs_token *t) {
 	++index;
 	if (tag_id < 0) {
+		while (index < w->eid.n && entity_id_isfree(&w->eid, index))
+			++index;
 		if (index >= w->eid.n)
 			return -1;
 		t->id = index;
 		return index;
 	}
 	struct component_pool *c = &w->c[tag_id];
-	if (index >= c->n)
-		return -1;
-
-	int current_id = index_(c->id[index]);
-
-	if (index == 0 || c->stride != STRIDE_TAG) {
-		t->id = current_id;
+	if (c->flags & POOL_BITSET) {
+		index = bitset_next(c, index);
+		if (index >= 0)
+			t->id = index;
 		return index;
 	}
-
-	int last_id = t->id;
-	if (current_id == last_id) {
-		if (index_(c->id[index-1]) == last_id) {
-			remove_dup(c, index);
-			if (index >= c->n)
-				return -1;
-			t->id = index_(c->id[index]);
-			return index;
-		}
-	}
-	int i;
-	if (current_id <= last_id) {
-		for (i=index;i<c->n;i++) {
-			int id = index_(c->id[i]);
-			if (id > last_id) {
-				t->id = id;
-				return i;
-			}
-		}
-		return -1;
+	if (c->stride != STRIDE_TAG) {
+		if (index >= c->n + c->pending)
+			return -1;
+		t->id = index_(c->id[index]);
+		return index;
 	}
-	// current_id > last_id
-	int current_pos = index;
-	for (i=index-1;i>=0;i--) {
-		int id = index_(c->id[i]);
-		if (id > last_id) {
-			current_id = id;
-			current_pos = i;
+	int i = index < c->n ? index : c->n;
+	if (index > 0) {
+		// the rows may be moved by the insertions or the compaction, find the first one after t->id
+		int last_id = t->id;
+		if (i < c->n && (int)index_(c->id[i]) <= last_id) {
+			while (i < c->n && (int)index_(c->id[i]) <= last_id)
+				++i;
 		} else {
-			break;
+			while (i > 0 && (int)index_(c->id[i-1]) > last_id)
+				--i;
 		}
 	}
-	t->id = current_id;
-	return current_pos;
+	i = tomb_skip(c, i);
+	if (i >= c->n)
+		return -1;
+	t->id = index_(c->id[i]);
+	return i;
 }
 
 int
@@ -103,12 +127,13 @@ entity_count_(struct entity_world *w, int cid) {
 	if (cid < 0)
 		return w->eid.n;
 	struct component_pool *c = &w->c[cid];
-	return c->n;
+	return c->n + c->pending - c->tomb_n;
 }
 
 void
 entity_clear_type_(struct entity_world *w, int cid) {
 	struct component_pool *c = &w->c[cid];
+	ecs_pool_flush_(c);
 	if (c->stride == STRIDE_LUA && c->n > 0) {
 		lua_State *L = w->lua.L;
 		unsigned int * lua_index = (unsigned int *)c->buffer;
@@ -121,7 +146,18 @@ entity_clear_type_(struct entity_world *w, int cid) {
 		}
 		w->lua.freelist = next;
 	}
+	if (c->flags & POOL_SPARSE) {
+		int i;
+		for (i=0;i<c->n;i++) {
+			sparse_unset(c, c->id[i]);
+		}
+	}
+	if (c->flags & POOL_BITSET) {
+		memset(c->bits, 0, (c->cap >> 6) * sizeof(uint64_t));
+	}
+	tomb_reset(c);
 	c->n = 0;
+	++c->version;
 }
 
 int
@@ -148,6 +184,8 @@ entity_component_(struct entity_world *w, struct ecs_token t, int cid) {
 	}
 	if (id >=0) {
 		struct component_pool * cp = &w->c[cid];
+		if (cp->flags & POOL_SOA)
+			return DUMMY_PTR;
 		return get_ptr(cp, id);
 	} else {
 		return NULL;
@@ -165,6 +203,21 @@ entity_component_index_hint_(struct entity_world *w, struct ecs_token t, int cid
 	return -1;
 }
 
+// Reentrant, the cursor is the caller's instead of last_lookup
+int
+entity_component_index_r_(struct entity_world *w, struct ecs_token t, int cid, int *cursor) {
+	if (cid < 0) {
+		assert(t.id < w->eid.n);
+		return t.id;
+	}
+	// merged by entity_split, see entity_fetch_r_
+	assert(w->c[cid].pending == 0);
+	int result_index = ecs_lookup_component_(&w->c[cid], make_index_(t.id), *cursor);
+	if (result_index >= 0)
+		*cursor = result_index + 1;
+	return result_index;
+}
+
 static void *
 add_component_(struct entity_world *w, int cid, entity_index_t eid, const void *buffer) {
 	int index = ecs_add_component_id_(w, cid, eid);
@@ -174,8 +227,9 @@ add_component_(struct entity_world *w, int cid, entity_index_t eid, const void *
 	void *ret = get_ptr(pool, index);
 	if (buffer) {
 		assert(pool->stride >= 0);
-		memcpy(ret, buffer, pool->stride);
+		set_record(pool, index, buffer);
 	}
+	ecs_touch_(w, pool, index, 1);
 	return ret;
 }
 
@@ -197,7 +251,7 @@ entity_new_(struct entity_world *w, int cid, struct ecs_token *t) {
 	int index = ecs_add_component_id_(w, cid, eid);
 	if (index >= 0) {
 		if (t != NULL) {
-			if (cid >= 0) {
+			if (cid >= 0 && !(c->flags & POOL_BITSET)) {
 				t->id = index_(w->c[cid].id[index]);
 			} else {
 				t->id = index;
@@ -207,6 +261,29 @@ entity_new_(struct entity_world *w, int cid, struct ecs_token *t) {
 	return index;
 }
 
+int
+entity_new_batch_(struct entity_world *w, int n, int cn, const int cid[], const void *proto[], struct ecs_token *t) {
+	int i, j;
+	for (i = 0; i < cn; i++) {
+		int id = cid[i];
+		if (id < 0 || id >= MAX_COMPONENT || w->c[id].cap == 0 || w->c[id].stride == STRIDE_LUA)
+			return -1;
+		for (j = 0; j < i; j++) {
+			if (cid[j] == id)
+				return -1;
+		}
+	}
+	int first = entity_id_alloc_n(&w->eid, n);
+	if (first < 0)
+		return -1;
+	for (i = 0; i < cn; i++) {
+		ecs_append_component_n_(w, cid[i], first, n, proto ? proto[i] : NULL);
+	}
+	if (t)
+		t->id = first;
+	return n;
+}
+
 void
 entity_remove_(struct entity_world *w, struct ecs_token t) {
 	entity_enable_tag_(w, t, ENTITY_REMOVED);
@@ -216,34 +293,25 @@ static void
 insert_id(struct entity_world *w, int cid, entity_index_t eindex) {
 	struct component_pool *c = &w->c[cid];
 	assert(c->stride == STRIDE_TAG);
-	int from = 0;
-	int to = c->n;
-	const uint64_t *map = w->eid.id;
-	uint64_t eid = map[index_(eindex)];
-	// a common use is inserting tag continuously, so the first checkpoint is (to - 1)
-	int mid = to - 1;
-	while (from < to) {
-		entity_index_t aa_index = c->id[mid];
-		uint64_t aa = map[index_(aa_index)];
-		if (aa == eid)
-			return;
-		else if (aa < eid) {
-			from = mid + 1;
-		} else {
-			to = mid;
-		}
-		mid = (from + to) / 2;
+	if (c->flags & POOL_BITSET) {
+		ecs_bitset_set_(c, index_(eindex));
+		return;
 	}
-	// insert eid at [from]
-	if (from < c->n - 1) {
-		int i;
-		// Any dup id ?
-		for (i = from; i < c->n - 1; i++) {
-			if (ENTITY_INDEX_CMP(c->id[i] , c->id[i + 1])==0) {
-				memmove(c->id + from + 1, c->id + from, sizeof(entity_index_t) * (i - from));
-				c->id[from] = eindex;
+	if (c->tomb_n == 0) {
+		int from = 0;
+		int to = c->n;
+		// a common use is inserting tag continuously, so the first checkpoint is (to - 1)
+		int mid = to - 1;
+		while (from < to) {
+			int cmp = ENTITY_INDEX_CMP(c->id[mid], eindex);
+			if (cmp == 0)
 				return;
+			else if (cmp < 0) {
+				from = mid + 1;
+			} else {
+				to = mid;
 			}
+			mid = (from + to) / 2;
 		}
 	}
 	ecs_add_component_id_(w, cid, eindex);
@@ -255,40 +323,17 @@ entity_enable_tag_(struct entity_world *w, struct ecs_token t, int tag_id) {
 	insert_id(w, tag_id, eid);
 }
 
-static inline void
-replace_id(struct component_pool *c, int from, int to, entity_index_t eid) {
-	int i;
-	for (i = from; i < to; i++) {
-		c->id[i] = eid;
-	}
-}
-
 void
 entity_disable_tag_(struct entity_world *w, int tag_id, int index) {
 	struct component_pool *c = &w->c[tag_id];
+	if (c->flags & POOL_BITSET) {
+		ecs_bitset_clear_(c, index);
+		return;
+	}
 	assert(index >= 0 && index < c->n);
-	entity_index_t eid = c->id[index];
 	assert(c->stride == STRIDE_TAG);
-	int from, to;
-	// find next tag. You may disable subsquent tags in iteration.
-	// For example, The sequence is 1 3 5 7 9 . We are now on 5 , and disable 7 .
-	// We should change 7 to 9 ( 1 3 5 9 9 ) rather than 7 to 5 ( 1 3 5 5 9 )
-	//                   iterator ->   ^                                ^
-	for (to = index + 1; to < c->n; to++) {
-		if (ENTITY_INDEX_CMP(c->id[to] , eid)!=0) {
-			for (from = index - 1; from >= 0; from--) {
-				if (ENTITY_INDEX_CMP(c->id[from] , eid)!=0)
-					break;
-			}
-			replace_id(c, from + 1, to, c->id[to]);
-			return;
-		}
-	}
-	for (from = index - 1; from >= 0; from--) {
-		if (ENTITY_INDEX_CMP(c->id[from] , eid)!=0)
-			break;
-	}
-	c->n = from + 1;
+	// The row is marked, so the iterations on this tag are not disturbed
+	ecs_tag_disable_(c, index);
 }
 
 int
@@ -296,7 +341,7 @@ entity_get_lua_(struct entity_world *w, int cid, int index, void *L_) {
 	lua_State *L = (lua_State *)L_;
 	struct component_pool *c = &w->c[cid];
 	++index;
-	if (c->stride != STRIDE_LUA || index < 0 || index >= c->n) {
+	if (c->stride != STRIDE_LUA || index < 0 || index >= c->n + c->pending) {
 		return LUA_TNIL;
 	}
 	lua_State *tL = w->lua.L;
@@ -306,6 +351,131 @@ entity_get_lua_(struct entity_world *w, int cid, int index, void *L_) {
 	return t;
 }
 
+void *
+entity_column_(struct entity_world *w, int cid, int offset, int *stride) {
+	struct component_pool *c = &w->c[cid];
+	if (c->stride <= 0 || c->n + c->pending == 0 || (c->flags & POOL_PAGED)) {
+		// The pages are not continuous
+		return NULL;
+	}
+	if (!(c->flags & POOL_SOA)) {
+		if (offset < 0 || offset >= c->stride)
+			return NULL;
+		*stride = c->stride;
+		return (char *)c->buffer + offset;
+	}
+	int i;
+	for (i = 0; i < c->column_n; i++) {
+		if (c->column[i].offset == offset) {
+			*stride = c->column[i].size;
+			return get_column(c, i, 0);
+		}
+	}
+	return NULL;
+}
+
+void
+entity_changed_(struct entity_world *w, int cid, int index) {
+	struct component_pool *c = &w->c[cid];
+	assert(index >= 0 && index < c->n + c->pending);
+	ecs_touch_(w, c, index, 1);
+}
+
+// Leapfrog join : find the next entity after t->id which has all the components in cid[].
+// index[] are the cursors of the pools, zeros at the beginning. It gallops in each pool.
+int
+entity_join_(struct entity_world *w, int n, const int cid[], int index[], struct ecs_token *t) {
+	if (n <= 0)
+		return 0;
+	if (t->id < 0) {
+		// the join begins
+		ecs_flush_(w);
+	}
+	int target = t->id + 1;
+	int matched = 0;
+	int i = 0;
+	while (matched < n) {
+		struct component_pool *c = &w->c[cid[i]];
+		int id;
+		if (c->flags & POOL_BITSET) {
+			id = bitset_next(c, target);
+			if (id < 0)
+				return 0;
+			index[i] = id;
+		} else {
+			int pos = tomb_skip(c, ecs_seek_component_(c, target, index[i]));
+			index[i] = pos;
+			if (pos >= c->n)
+				return 0;
+			id = (int)index_(c->id[pos]);
+		}
+		if (id == target) {
+			++matched;
+		} else {
+			target = id;
+			matched = 1;
+		}
+		if (++i >= n)
+			i = 0;
+	}
+	t->id = target;
+	return 1;
+}
+
+// The entity at the row of the pool, -1 for an absent bitset tag or a disabled tag
+static inline int
+row_entity(struct component_pool *c, int row) {
+	if (c->flags & POOL_BITSET)
+		return bitset_test(c, row) ? row : -1;
+	if (tomb_test(c, row))
+		return -1;
+	return (int)index_(c->id[row]);
+}
+
+// The run of rows from the next joined entity, which are consecutive in all the pools.
+// ptr[i] is the first row of the run in the pool cid[i], or NULL for tag, lua object and POOL_SOA.
+// Returns the number of rows in the run, t->id is the last entity of it.
+int
+entity_span_(struct entity_world *w, int n, const int cid[], int index[], void *ptr[], struct ecs_token *t) {
+	if (!entity_join_(w, n, cid, index, t))
+		return 0;
+	struct component_pool *c = &w->c[cid[0]];
+	int max = INT_MAX;
+	int i;
+	for (i = 0; i < n; i++) {
+		struct component_pool *p = &w->c[cid[i]];
+		// the rows of bitset are the entities
+		int m = ((p->flags & POOL_BITSET) ? p->cap : p->n) - index[i];
+		if (p->flags & POOL_PAGED) {
+			// don't cross the page
+			int left = POOL_PAGE_SIZE - (index[i] & POOL_PAGE_MASK);
+			if (left < m)
+				m = left;
+		}
+		if (m < max)
+			max = m;
+		if (p->stride > 0 && !(p->flags & POOL_SOA))
+			ptr[i] = get_ptr(p, index[i]);
+		else
+			ptr[i] = NULL;
+	}
+	int r;
+	int last = t->id;
+	for (r = 1; r < max; r++) {
+		int id = row_entity(c, index[0] + r);
+		if (id < 0)
+			break;
+		for (i = 1; i < n; i++) {
+			if (row_entity(&w->c[cid[i]], index[i] + r) != id)
+				goto end;
+		}
+		last = id;
+	}
+end:
+	t->id = last;
+	return r;
+}
+
 int
 entity_index_(struct entity_world *w, void *eid_) {
 	uint64_t eid = (uint64_t)eid_;
@@ -313,6 +483,38 @@ entity_index_(struct entity_world *w, void *eid_) {
 	return index;
 }
 
+int
+entity_index_r_(struct entity_world *w, void *eid, int *hint) {
+	return entity_id_find_hint(&w->eid, (uint64_t)eid, hint);
+}
+
+// Split the rows of the smallest pool in cid[] (the driver) into nrange ranges, range[0 .. nrange] are the bounds.
+// It flushes the staged components, so the joins in the ranges only read the world.
+int
+entity_split_(struct entity_world *w, int n, const int cid[], int nrange, int range[]) {
+	ecs_flush_(w);
+	int driver = -1;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (w->c[cid[i]].flags & POOL_BITSET)
+			continue;
+		if (driver < 0 || w->c[cid[i]].n < w->c[cid[driver]].n)
+			driver = i;
+	}
+	int rows;
+	if (driver < 0) {
+		// all bitsets, split the entities
+		driver = 0;
+		rows = w->eid.n;
+	} else {
+		rows = w->c[cid[driver]].n;
+	}
+	for (i = 0; i <= nrange; i++) {
+		range[i] = (int)((int64_t)rows * i / nrange);
+	}
+	return driver;
+}
+
 #define HASHSET 127
 #define HASHSET_UNKNOWN 0
 #define HASHSET_SET 1
@@ -368,8 +570,10 @@ entity_propagate_tag_(struct entity_world *w, int cid, int tag_id) {
 	if (cid < 0 || cid >= MAX_COMPONENT) {
 		return -1;
 	}
+	ecs_flush_(w);
 	struct component_pool *c = &w->c[cid];
-	if (c->cap == 0 || c->stride < sizeof(uint64_t)) {
+	if (c->cap == 0 || c->stride < sizeof(uint64_t)
+		|| ((c->flags & POOL_SOA) && c->column[0].size < sizeof(uint64_t))) {
 		// Should be a C Componet with an eid (uint64)
 		return -1;
 	}
@@ -381,6 +585,19 @@ entity_propagate_tag_(struct entity_world *w, int cid, int tag_id) {
 		// no tags
 		return 0;
 	}
+	if (tag->flags & POOL_BITSET) {
+		int i;
+		for (i = 0; i < c->n; i++) {
+			uint64_t eid = *(uint64_t *)get_ptr(c, i);
+			if (eid > 0) {
+				int index = entity_id_find(&w->eid, eid);
+				if (index >= 0 && bitset_test(tag, index))
+					ecs_bitset_set_(tag, index_(c->id[i]));
+			}
+		}
+		return 0;
+	}
+	ecs_tag_compact_(tag);
 	ecs_reserve_component_(tag, tag_id, tag->n + c->n);
 	entity_index_t *root = &tag->id[c->n];
 	int root_n = tag->n;
@@ -391,8 +608,12 @@ entity_propagate_tag_(struct entity_world *w, int cid, int tag_id) {
 	struct eid_cache cache;
 	cache_init(&cache);
 	int start = find_first(c->id, c->n, *root);
-	char * parent = (char *)c->buffer + start * c->stride;
+	// the eid of parent is the first field
+	int parent_stride = (c->flags & POOL_SOA) ? c->column[0].size : c->stride;
+	char * parent = (char *)c->buffer + start * parent_stride;
 	for (i=start;i<c->n;i++) {
+		if (c->flags & POOL_PAGED)
+			parent = (char *)get_ptr(c, i);
 		if (root_n > 0 && ENTITY_INDEX_CMP(c->id[i], *root) >= 0) {
 			APPEND_EID(*root);
 			++root;
@@ -421,11 +642,271 @@ entity_propagate_tag_(struct entity_world *w, int cid, int tag_id) {
 				}
 			}
 		}
-		parent += c->stride;
+		parent += parent_stride;
 	}
 	for (i=0;i<root_n;i++) {
 		APPEND_EID(*root);
 		++root;
 	}
+	ecs_sparse_rebuild_(tag);
 	return 0;
 }
+
+// The entities of a pool in order, for the merges of tag_op
+struct pool_cursor {
+	struct component_pool *c;
+	int row;
+	int e;	// the current entity, INT_MAX at the end
+};
+
+// Move the cursor to the first entity >= e
+static void
+cursor_seek(struct pool_cursor *p, int e) {
+	struct component_pool *c = p->c;
+	if (p->e >= e)
+		return;
+	if (c->flags & POOL_BITSET) {
+		int r = bitset_next(c, e);
+		p->e = r < 0 ? INT_MAX : r;
+		return;
+	}
+	int row = p->row;
+	while (row < c->n && ((int)index_(c->id[row]) < e || tomb_test(c, row)))
+		++row;
+	p->row = row;
+	p->e = row < c->n ? (int)index_(c->id[row]) : INT_MAX;
+}
+
+static inline uint64_t
+bitset_word(struct component_pool *c, int i) {
+	return i < (c->cap >> 6) ? c->bits[i] : 0;
+}
+
+static int
+tag_op_bitset(int op, struct component_pool *d, int n, struct component_pool *s[]) {
+	int cap = s[0]->cap;
+	int i, j;
+	for (i = 1; i < n; i++) {
+		if (op == ECS_TAG_UNION ? s[i]->cap > cap : (op == ECS_TAG_INTERSECT && s[i]->cap < cap))
+			cap = s[i]->cap;
+	}
+	int words = cap >> 6;
+	uint64_t *bits = words > 0 ? (uint64_t *)ecs_malloc_(d->alloc, ECS_MEM_TAG, words * sizeof(uint64_t)) : NULL;
+	int count = 0;
+	for (j = 0; j < words; j++) {
+		uint64_t v = bitset_word(s[0], j);
+		for (i = 1; i < n; i++) {
+			uint64_t b = bitset_word(s[i], j);
+			switch (op) {
+			case ECS_TAG_UNION: v |= b; break;
+			case ECS_TAG_INTERSECT: v &= b; break;
+			default: v &= ~b; break;
+			}
+		}
+		bits[j] = v;
+		count += __builtin_popcountll(v);
+	}
+	// d may be one of s[]
+	ecs_free_(d->alloc, d->bits);
+	d->bits = bits;
+	d->cap = cap;
+	d->n = count;
+	++d->version;
+	return count;
+}
+
+int
+entity_tag_op_(struct entity_world *w, int op, int dst, int n, const int src[]) {
+	if (op < ECS_TAG_UNION || op > ECS_TAG_SUBTRACT || n <= 0 || n > MAX_COMPONENT
+		|| dst < 0 || dst >= MAX_COMPONENT || w->c[dst].stride != STRIDE_TAG) {
+		return -1;
+	}
+	struct component_pool *s[MAX_COMPONENT];
+	struct component_pool *d = &w->c[dst];
+	int bitset = d->flags & POOL_BITSET;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (src[i] < 0 || src[i] >= MAX_COMPONENT)
+			return -1;
+		s[i] = &w->c[src[i]];
+		if (!(s[i]->flags & POOL_BITSET))
+			bitset = 0;
+	}
+	ecs_flush_(w);
+	if (bitset)
+		return tag_op_bitset(op, d, n, s);
+	// the result can't be more than bound
+	int bound = s[0]->n;
+	for (i = 1; i < n; i++) {
+		if (op == ECS_TAG_UNION)
+			bound += s[i]->n;
+		else if (op == ECS_TAG_INTERSECT && s[i]->n < bound)
+			bound = s[i]->n;
+	}
+	entity_index_t *ids = bound > 0 ? (entity_index_t *)ecs_malloc_(&w->alloc, ECS_MEM_OTHER, bound * sizeof(entity_index_t)) : NULL;
+	struct pool_cursor cur[MAX_COMPONENT];
+	for (i = 0; i < n; i++) {
+		cur[i].c = s[i];
+		cur[i].row = 0;
+		cur[i].e = -1;
+		cursor_seek(&cur[i], 0);
+	}
+	int m = 0;
+	int e;
+	switch (op) {
+	case ECS_TAG_UNION:
+		for (;;) {
+			e = INT_MAX;
+			for (i = 0; i < n; i++) {
+				if (cur[i].e < e)
+					e = cur[i].e;
+			}
+			if (e == INT_MAX)
+				break;
+			ids[m++] = make_index_(e);
+			for (i = 0; i < n; i++) {
+				cursor_seek(&cur[i], e + 1);
+			}
+		}
+		break;
+	case ECS_TAG_INTERSECT:
+		e = 0;
+		for (;;) {
+			int next = e;
+			for (i = 0; i < n; i++) {
+				cursor_seek(&cur[i], e);
+				if (cur[i].e > next)
+					next = cur[i].e;
+			}
+			if (next == INT_MAX)
+				break;
+			if (next == e) {
+				ids[m++] = make_index_(e);
+				++e;
+			} else {
+				e = next;
+			}
+		}
+		break;
+	default:
+		while ((e = cur[0].e) != INT_MAX) {
+			for (i = 1; i < n; i++) {
+				cursor_seek(&cur[i], e);
+				if (cur[i].e == e)
+					break;
+			}
+			if (i == n)
+				ids[m++] = make_index_(e);
+			cursor_seek(&cur[0], e + 1);
+		}
+		break;
+	}
+	// d may be one of s[], so write it after the merge
+	if (d->flags & POOL_BITSET) {
+		memset(d->bits, 0, (d->cap >> 6) * sizeof(uint64_t));
+		d->n = 0;
+		for (i = 0; i < m; i++) {
+			ecs_bitset_set_(d, index_(ids[i]));
+		}
+	} else {
+		if (d->flags & POOL_SPARSE) {
+			for (i = 0; i < d->n; i++) {
+				sparse_unset(d, d->id[i]);
+			}
+		}
+		tomb_reset(d);
+		d->n = 0;
+		if (m > 0) {
+			ecs_reserve_component_(d, dst, m);
+			memcpy(d->id, ids, m * sizeof(entity_index_t));
+			d->n = m;
+		}
+		ecs_sparse_sync_(d, 0);
+	}
+	++d->version;
+	ecs_free_(&w->alloc, ids);
+	return m;
+}
+
+int
+entity_hierarchy_(struct entity_world *w, int cid, const int **order, const int **parent) {
+	struct entity_hierarchy *H = entity_hierarchy_sync_(w, cid);
+	if (H == NULL)
+		return -1;
+	*order = H->order;
+	*parent = H->parent;
+	return H->order_n;
+}
+
+int
+entity_propagate_all_(struct entity_world *w, int cid, int tag_id) {
+	if (tag_id < 0 || tag_id >= MAX_COMPONENT || w->c[tag_id].stride != STRIDE_TAG)
+		return -1;
+	struct entity_hierarchy *H = entity_hierarchy_sync_(w, cid);
+	if (H == NULL)
+		return -1;
+	struct component_pool *c = &w->c[cid];
+	struct component_pool *tag = &w->c[tag_id];
+	if (tag->n == 0 || H->n == 0)
+		return 0;
+	int bitset = tag->flags & POOL_BITSET;
+	if (!bitset)
+		ecs_tag_compact_(tag);
+	int n = H->n;
+	// 1 : tagged, 2 : tagged by propagation
+	uint8_t *mark = (uint8_t *)ecs_malloc_(&w->alloc, ECS_MEM_OTHER, n);
+	int i;
+	struct pool_cursor cur = { tag, 0, -1 };
+	for (i = 0; i < n; i++) {
+		int e = index_(c->id[i]);
+		if (bitset) {
+			mark[i] = bitset_test(tag, e);
+		} else {
+			cursor_seek(&cur, e);
+			mark[i] = cur.e == e;
+		}
+	}
+	int added = 0;
+	for (i = 0; i < H->order_n; i++) {
+		int row = H->order[i];
+		if (mark[row])
+			continue;
+		int p = H->parent[row];
+		if (p >= 0) {
+			if (!mark[p])
+				continue;
+		} else if (H->parent_index[row] < 0
+			|| ecs_lookup_component_(tag, make_index_(H->parent_index[row]), -1) < 0) {
+			continue;
+		}
+		mark[row] = 2;
+		++added;
+	}
+	if (added > 0) {
+		if (bitset) {
+			for (i = 0; i < n; i++) {
+				if (mark[i] == 2)
+					ecs_bitset_set_(tag, index_(c->id[i]));
+			}
+		} else {
+			// merge the new tags from the back
+			int tn = tag->n;
+			ecs_reserve_component_(tag, tag_id, tn + added);
+			int k = tn + added;
+			int j = tn - 1;
+			for (i = n - 1; i >= 0; i--) {
+				if (mark[i] != 2)
+					continue;
+				while (j >= 0 && ENTITY_INDEX_CMP(tag->id[j], c->id[i]) > 0) {
+					tag->id[--k] = tag->id[j--];
+				}
+				tag->id[--k] = c->id[i];
+			}
+			tag->n = tn + added;
+			++tag->version;
+			ecs_sparse_rebuild_(tag);
+		}
+	}
+	ecs_free_(&w->alloc, mark);
+	return added;
+}
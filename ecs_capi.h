@@ -7,12 +7,15 @@
 struct entity_world;
 
 void *entity_fetch_(struct entity_world *w, int cid, int index, struct ecs_token *t);
+void *entity_fetch_c_(struct entity_world *w, int cid, int index, struct ecs_token *t);
+void *entity_fetch_r_(struct entity_world *w, int cid, int index, struct ecs_token *t);
 void entity_clear_type_(struct entity_world *w, int cid);
 void *entity_component_(struct entity_world *w, struct ecs_token t, int cid);
 int entity_component_index_(struct entity_world *w, struct ecs_token t, int cid);
 int entity_component_index_hint_(struct entity_world *w, struct ecs_token t, int cid, int hint);
 void * entity_component_add_(struct entity_world *w, struct ecs_token t, int cid, const void *buffer);
 int entity_new_(struct entity_world *w, int cid, struct ecs_token *t);
+int entity_new_batch_(struct entity_world *w, int n, int cn, const int cid[], const void *proto[], struct ecs_token *t);
 void entity_remove_(struct entity_world *w, struct ecs_token t);
 void entity_enable_tag_(struct entity_world *w, struct ecs_token t, int tag_id);
 void entity_disable_tag_(struct entity_world *w, int tag_id, int index);
@@ -21,5 +24,15 @@ int entity_get_lua_(struct entity_world *w, int cid, int index, void *L);
 int entity_count_(struct entity_world *w, int cid);
 int entity_index_(struct entity_world *w, void *eid);
 int entity_propagate_tag_(struct entity_world *w, int cid, int tag_id);
+void *entity_column_(struct entity_world *w, int cid, int offset, int *stride);
+void entity_changed_(struct entity_world *w, int cid, int index);
+int entity_join_(struct entity_world *w, int n, const int cid[], int index[], struct ecs_token *t);
+int entity_component_index_r_(struct entity_world *w, struct ecs_token t, int cid, int *cursor);
+int entity_index_r_(struct entity_world *w, void *eid, int *hint);
+int entity_split_(struct entity_world *w, int n, const int cid[], int nrange, int range[]);
+int entity_hierarchy_(struct entity_world *w, int cid, const int **order, const int **parent);
+int entity_propagate_all_(struct entity_world *w, int cid, int tag_id);
+int entity_tag_op_(struct entity_world *w, int op, int dst, int n, const int src[]);
+int entity_span_(struct entity_world *w, int n, const int cid[], int index[], void *ptr[], struct ecs_token *t);
 
 #endif
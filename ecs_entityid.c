@@ -1,14 +1,50 @@
 #include "ecs_entityid.h"
 #include "ecs_entityindex.h"
 
-#include <stdlib.h>
 
 #define ENTITY_INIT_SIZE 4096
 
 void
 entity_id_deinit(struct entity_id *e) {
-	free(e->id);
+	ecs_free_(e->alloc, e->id);
 	e->id = NULL;
+	ecs_free_(e->alloc, e->block);
+	e->block = NULL;
+	e->block_n = 0;
+	e->block_cap = 0;
+}
+
+// Append the eid at index, the eids are increasing
+static void
+block_append(struct entity_id *e, uint64_t eid, int index) {
+	uint64_t b = eid >> ENTITY_BLOCK_SHIFT;
+	if (e->block_n == 0)
+		e->block_base = b;
+	b -= e->block_base;
+	if (b < e->block_n)
+		return;
+	if (b >= e->block_cap) {
+		uint64_t cap = e->block_cap * 3 / 2 + 1;
+		if (cap <= b)
+			cap = b + 1;
+		e->block = (int *)ecs_realloc_(e->alloc, ECS_MEM_EID, e->block, (size_t)cap * sizeof(int));
+		e->block_cap = cap;
+	}
+	while (e->block_n <= b) {
+		e->block[e->block_n++] = index;
+	}
+}
+
+// The blocks are rebuilt after the ids are removed or loaded
+void
+entity_id_rebuild(struct entity_id *e) {
+	e->block_n = 0;
+	if (e->stable)
+		return;
+	uint32_t i;
+	for (i = 0; i < e->n; i++) {
+		block_append(e, e->id[i], i);
+	}
 }
 
 static int
@@ -28,8 +64,18 @@ find_eid_(struct entity_id *e, uint64_t eid, int begin, int end) {
 	return -p;
 }
 
+static inline int
+find_stable_(struct entity_id *e, uint64_t eid) {
+	uint32_t slot = (uint32_t)(eid & MAX_ENTITY);
+	if (slot < e->n && e->id[slot] == eid)
+		return slot;
+	return -1;
+}
+
 int
 entity_id_find_guessrange(struct entity_id *e, uint64_t eid, int begin, int end) {
+	if (e->stable)
+		return find_stable_(e, eid);
 	if (end >= e->n) {
 		return find_eid_(e, eid, begin, e->n);
 	} else {
@@ -42,39 +88,46 @@ entity_id_find_guessrange(struct entity_id *e, uint64_t eid, int begin, int end)
 	}
 }
 
+// Reentrant, it only reads the blocks
 int
 entity_id_find(struct entity_id *e, uint64_t eid) {
-	unsigned h = (unsigned)(2654435761 * (uint32_t)eid) % ENTITY_ID_LOOKUP;
-	entity_index_t p = e->lookup[h];
-	int index = index_(p);
-	int begin = 0;
-	int end;
-	if (index >= e->n) {
-		end = e->n;
-	} else {
-		uint64_t v = e->id[index];
-		if (v == eid) {
-			return index;
-		}
-		if (v > eid) {
-			end = index;
-		} else {
-			begin = index + 1;
-			end = e->n;
-		}
-	}
-	index = find_eid_(e, eid, begin, end);
-	if (index < 0) {
-		e->lookup[h] = make_index_(-index);
+	if (e->stable)
+		return find_stable_(e, eid);
+	uint64_t b = eid >> ENTITY_BLOCK_SHIFT;
+	if (b < e->block_base || b - e->block_base >= e->block_n)
 		return -1;
-	} else {
-		e->lookup[h] = make_index_(index);
-		return index;
+	b -= e->block_base;
+	int begin = e->block[b];
+	int end = b + 1 < e->block_n ? e->block[b+1] : (int)e->n;
+	if (begin >= end || eid < e->id[begin])
+		return -1;
+	// the eids are increasing, so the index is no more than begin + (eid - id[begin])
+	int guess = begin + (int)(eid - e->id[begin]);
+	if (guess < end) {
+		if (e->id[guess] == eid)
+			return guess;
+		end = guess;
 	}
+	int index = find_eid_(e, eid, begin, end);
+	return index < 0 ? -1 : index;
+}
+
+// Reentrant, the guess is from the caller
+int
+entity_id_find_hint(struct entity_id *e, uint64_t eid, int *hint) {
+	int index = *hint;
+	if (index >= 0 && index < e->n && e->id[index] == eid)
+		return index;
+	index = entity_id_find(e, eid);
+	if (index >= 0)
+		*hint = index;
+	return index;
 }
 
 int
 entity_id_find_last(struct entity_id *e, uint64_t eid) {
+	if (e->stable)
+		return find_stable_(e, eid);
 	if (e->n == 0)
 		return -1;
 	int n = e->n - 1;
@@ -87,29 +140,87 @@ entity_id_find_last(struct entity_id *e, uint64_t eid) {
 
 size_t
 entity_id_memsize(struct entity_id *e) {
-	return sizeof(uint64_t) * e->cap;
+	return sizeof(uint64_t) * e->cap + sizeof(int) * e->block_cap;
 }
 
 int
 entity_id_alloc(struct entity_id *e, uint64_t *eid) {
+	if (e->free_n > 0) {
+		// reuse the last freed slot
+		int slot = e->freelist;
+		e->freelist = (uint32_t)(e->id[slot] & MAX_ENTITY);
+		--e->free_n;
+		++e->version;
+		*eid = ++e->last_id << ENTITY_SLOT_BITS | slot;
+		e->id[slot] = *eid;
+		return slot;
+	}
 	int n = e->n;
 	if (n >= MAX_ENTITY) {
 		return -1;
 	}
 	e->n++;
+	++e->version;
 
 	if (n >= e->cap) {
 		if (e->id == NULL) {
 			e->cap = ENTITY_INIT_SIZE;
-			e->id = (uint64_t *)malloc(e->cap * sizeof(uint64_t));
+			e->id = (uint64_t *)ecs_malloc_(e->alloc, ECS_MEM_EID, e->cap * sizeof(uint64_t));
 		} else {
 		int newcap = e->cap * 3 / 2 + 1;
-			e->id = (uint64_t *)realloc(e->id, newcap * sizeof(uint64_t));
+			e->id = (uint64_t *)ecs_realloc_(e->alloc, ECS_MEM_EID, e->id, newcap * sizeof(uint64_t));
 			e->cap = newcap;
 		}
 	}
 	*eid = ++e->last_id;
+	if (e->stable)
+		*eid = *eid << ENTITY_SLOT_BITS | n;
+	else
+		block_append(e, *eid, n);
 	e->id[n] = *eid;
 
 	return n;
 }
+
+// Alloc n continuous eids, returns the index of the first one
+int
+entity_id_alloc_n(struct entity_id *e, int n) {
+	int first = e->n;
+	if (n <= 0 || n > MAX_ENTITY - first) {
+		return -1;
+	}
+	if (first + n > e->cap) {
+		int newcap = e->cap * 3 / 2 + 1;
+		if (newcap < ENTITY_INIT_SIZE)
+			newcap = ENTITY_INIT_SIZE;
+		if (newcap < first + n)
+			newcap = first + n;
+		e->id = (uint64_t *)ecs_realloc_(e->alloc, ECS_MEM_EID, e->id, newcap * sizeof(uint64_t));
+		e->cap = newcap;
+	}
+	int i;
+	if (e->stable) {
+		for (i = 0; i < n; i++) {
+			e->id[first + i] = ++e->last_id << ENTITY_SLOT_BITS | (first + i);
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			e->id[first + i] = ++e->last_id;
+			block_append(e, e->id[first + i], first + i);
+		}
+	}
+	e->n += n;
+	++e->version;
+	return first;
+}
+
+// Stable mode only, the slot keeps its index and goes into the freelist
+void
+entity_id_free(struct entity_id *e, int index) {
+	if (entity_id_isfree(e, index))
+		return;
+	e->id[index] = ENTITY_ID_FREE | (e->free_n > 0 ? e->freelist : MAX_ENTITY);
+	e->freelist = index;
+	++e->free_n;
+	++e->version;
+}
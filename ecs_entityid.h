@@ -3,22 +3,49 @@
 
 #include <stdint.h>
 #include "ecs_entityindex.h"
+#include "ecs_alloc.h"
 
-#define ENTITY_ID_LOOKUP 8191
+// Not stable mode : the eids are increasing, the index of eid is found in the block of eid >> ENTITY_BLOCK_SHIFT
+#define ENTITY_BLOCK_SHIFT 6
+
+// Stable mode : eid = serial << ENTITY_SLOT_BITS | slot, free slots are linked by id[]
+#ifdef ECS_INDEX32
+#define ENTITY_SLOT_BITS 31
+#else
+#define ENTITY_SLOT_BITS 24
+#endif
+#define ENTITY_ID_FREE ((uint64_t)1 << 63)
 
 struct entity_id {
 	uint32_t n;
 	uint32_t cap;
 	uint64_t last_id;
 	uint64_t *id;
-	entity_index_t lookup[ENTITY_ID_LOOKUP];
+	struct ecs_allocator *alloc;
+	int stable;
+	uint32_t freelist;
+	uint32_t free_n;
+	uint32_t version;	// bumped when an id is added or removed
+	uint64_t block_n;	// follows the span of eids (the oldest live one to the newest), not the number of entities
+	uint64_t block_cap;
+	uint64_t block_base;	// the block of the first eid
+	int *block;	// the index of the first eid >= (block_base + i) << ENTITY_BLOCK_SHIFT
 };
 
+static inline int
+entity_id_isfree(struct entity_id *e, int index) {
+	return (e->id[index] & ENTITY_ID_FREE) != 0;
+}
+
 int entity_id_alloc(struct entity_id *e, uint64_t *eid);
+int entity_id_alloc_n(struct entity_id *e, int n);
+void entity_id_free(struct entity_id *e, int index);
+void entity_id_rebuild(struct entity_id *e);
 size_t entity_id_memsize(struct entity_id *e);
 void entity_id_deinit(struct entity_id *e);
 int entity_id_find(struct entity_id *e, uint64_t eid);
 int entity_id_find_last(struct entity_id *e, uint64_t eid);
+int entity_id_find_hint(struct entity_id *e, uint64_t eid, int *hint);
 int entity_id_find_guessrange(struct entity_id *e, uint64_t eid, int begin, int end);
 
 #endif
@@ -4,7 +4,35 @@
 #include <string.h>
 #include <stdint.h>
 
-#define MAX_ENTITY 0xffffff 
+#ifdef ECS_INDEX32
+
+// 4 bytes aligned index, for more than 16M entities
+
+#define MAX_ENTITY 0x7fffffff
+
+typedef struct { uint32_t idx; } entity_index_t;
+
+static const entity_index_t INVALID_ENTITY = { MAX_ENTITY };
+
+static inline uint32_t
+index_(entity_index_t x) {
+	return x.idx;
+}
+
+static inline entity_index_t
+make_index_(uint32_t v) {
+	entity_index_t r = { v };
+	return r;
+}
+
+static inline int
+ENTITY_INDEX_CMP(entity_index_t a, entity_index_t b) {
+	return (a.idx > b.idx) - (a.idx < b.idx);
+}
+
+#else
+
+#define MAX_ENTITY 0xffffff
 
 typedef struct { uint8_t idx[3]; } entity_index_t;
 
@@ -12,7 +40,7 @@ static const entity_index_t INVALID_ENTITY = { { 0xff, 0xff, 0xff } };
 
 static inline uint32_t
 index_(entity_index_t x) {
-	return (uint32_t) x.idx[0] << 16 | (uint32_t) x.idx[1] << 8 | x.idx[2]; 
+	return (uint32_t) x.idx[0] << 16 | (uint32_t) x.idx[1] << 8 | x.idx[2];
 }
 
 static inline entity_index_t
@@ -22,13 +50,15 @@ make_index_(uint32_t v) {
 }
 
 static inline int
-INVALID_ENTITY_INDEX(entity_index_t e) {
-	return index_(e) == MAX_ENTITY;
+ENTITY_INDEX_CMP(entity_index_t a, entity_index_t b) {
+	return memcmp(&a, &b, sizeof(a));
 }
 
+#endif
+
 static inline int
-ENTITY_INDEX_CMP(entity_index_t a, entity_index_t b) {
-	return memcmp(&a, &b, sizeof(a));
+INVALID_ENTITY_INDEX(entity_index_t e) {
+	return index_(e) == MAX_ENTITY;
 }
 
 static inline entity_index_t
@@ -35,9 +35,10 @@ void
 entity_group_deinit_(struct entity_group_arena *G) {
 	int i;
 	for (i=0;i<G->n;i++) {
-		free(G->g[i]);
+		ecs_free_(G->alloc, G->g[i]->s);
+		ecs_free_(G->alloc, G->g[i]);
 	}
-	free(G->g);
+	ecs_free_(G->alloc, G->g);
 }
 
 size_t
@@ -51,14 +52,14 @@ entity_group_memsize_(struct entity_group_arena *G) {
 }
 
 static inline void
-add_byte(struct entity_group *g, uint8_t b) {
+add_byte(struct ecs_allocator *A, struct entity_group *g, uint8_t b) {
 	if (g->n >= g->cap) {
 		if (g->s == NULL) {
 			g->cap = DEFAULT_GROUP_SIZE;
-			g->s = (uint8_t *)malloc(DEFAULT_GROUP_SIZE);
+			g->s = (uint8_t *)ecs_malloc_(A, ECS_MEM_GROUP, DEFAULT_GROUP_SIZE);
 		} else {
 			int newcap = g->cap * 3 / 2 + 1;
-			g->s = (uint8_t *)realloc(g->s, newcap);
+			g->s = (uint8_t *)ecs_realloc_(A, ECS_MEM_GROUP, g->s, newcap);
 			g->cap = newcap;
 		}
 	}
@@ -66,16 +67,16 @@ add_byte(struct entity_group *g, uint8_t b) {
 }
 
 static void
-add_eid(struct entity_group *g, uint64_t eid) {
+add_eid(struct ecs_allocator *A, struct entity_group *g, uint64_t eid) {
 	uint64_t eid_diff = eid - g->last - 1;
 	if (eid_diff < 128) {
-		add_byte(g, eid_diff);
+		add_byte(A, g, eid_diff);
 	} else {
 		do {
-			add_byte(g, (eid_diff & 0x7f) | 0x80);
+			add_byte(A, g, (eid_diff & 0x7f) | 0x80);
 			eid_diff >>= 7;
 		} while (eid_diff >= 128);
-		add_byte(g, eid_diff);
+		add_byte(A, g, eid_diff);
 	}
 	g->last = eid;
 }
@@ -100,12 +101,12 @@ decode_eid(struct entity_group *g, struct entity_iterator *iter) {
 		++i;
 		assert(i < iter->n);
 		if (s[i] < 128) {
-			diff |= s[i] << shift;
+			diff |= (uint64_t)s[i] << shift;
 			iter->eid += diff + 1;
 			iter->decode_pos = i + 1;
 			return;
 		} else {
-			diff |= (s[i] & 0x7f) << shift;
+			diff |= (uint64_t)(s[i] & 0x7f) << shift;
 		}
 		shift += 7;
 	}
@@ -137,20 +138,20 @@ insert_group(struct entity_group_arena *G, int groupid, int begin, int end) {
 	if (G->n >= G->cap) {
 		if (G->g == NULL) {
 			G->cap = DEFAULT_GROUP_SIZE;
-			G->g = (struct entity_group **)malloc(G->cap * sizeof(struct entity_group *));
+			G->g = (struct entity_group **)ecs_malloc_(G->alloc, ECS_MEM_GROUP, G->cap * sizeof(struct entity_group *));
 		} else {
 			G->cap = G->cap * 3 / 2 + 1;
-			struct entity_group ** g = (struct entity_group **)malloc(G->cap * sizeof(struct entity_group *));
+			struct entity_group ** g = (struct entity_group **)ecs_malloc_(G->alloc, ECS_MEM_GROUP, G->cap * sizeof(struct entity_group *));
 			memcpy(g, G->g, begin * sizeof(struct entity_group *));
 			memcpy(g+begin+1, G->g + begin, (G->n - begin) * sizeof(struct entity_group *));
-			free(G->g);
+			ecs_free_(G->alloc, G->g);
 			G->g = g;
 		}
 	} else {
 		memmove(G->g+begin+1, G->g+begin, (G->n - begin) * sizeof(struct entity_group *));
 	}
 	++G->n;
-	struct entity_group *group = (struct entity_group *)malloc(sizeof(struct entity_group));
+	struct entity_group *group = (struct entity_group *)ecs_malloc_(G->alloc, ECS_MEM_GROUP, sizeof(struct entity_group));
 	memset(group, 0, sizeof(*group));
 	group->groupid = groupid;
 
@@ -188,7 +189,7 @@ entity_group_add_(struct entity_group_arena *G, int groupid, uint64_t eid) {
 	if (eid <= g->last) {
 		return 0;
 	} else {
-		add_eid(g, eid);
+		add_eid(G->alloc, g, eid);
 		return 1;
 	}
 }
@@ -223,7 +224,7 @@ tag_index(struct entity_world *w, struct tag_index_context *ctx) {
 	if (index >= 0) {
 		if (need_encode) {
 			// previous eid removed, encode current eid
-			add_eid(group, min_id);
+			add_eid(w->group.alloc, group, min_id);
 			iter->encode_pos = group->n;
 		} else {
 			iter->encode_pos = ctx->iter[ii].decode_pos;
@@ -308,6 +309,17 @@ entity_group_id_(struct entity_group_arena *G, int groupid, lua_State *L) {
 
 #ifdef TEST_GROUP_CODEC
 
+static void *
+test_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+static struct ecs_allocator test_allocator = { test_alloc };
+
 static void
 test_add_item() {
 	struct entity_group g;
@@ -315,7 +327,7 @@ test_add_item() {
 	uint64_t eid = 1;
 	int i;
 	for (i=0;i<10;i++) {
-		add_eid(&g, eid);
+		add_eid(&test_allocator, &g, eid);
 		eid += i*2;
 	}
 
@@ -333,6 +345,7 @@ static void
 test_group_add() {
 	struct entity_group_arena g;
 	memset(&g, 0, sizeof(g));
+	g.alloc = &test_allocator;
 	int groupid = 10000;
 	int i;
 	for (i=0;i<100000;i++) {
@@ -9,12 +9,14 @@
 
 struct entity_group;
 struct entity_world;
+struct ecs_allocator;
 
 struct entity_group_arena {
 	int n;
 	int cap;
 	int cache[ENTITY_GROUP_CACHE_SIZE];
 	struct entity_group **g;
+	struct ecs_allocator *alloc;
 };
 
 void entity_group_deinit_(struct entity_group_arena *);
@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "ecs_internal.h"
+#include "ecs_hierarchy.h"
+#include "ecs_entityid.h"
+
+void
+entity_hierarchy_deinit_(struct entity_hierarchy *H) {
+	ecs_free_(H->alloc, H->parent_eid);
+	ecs_free_(H->alloc, H->parent);
+	ecs_free_(H->alloc, H->parent_index);
+	ecs_free_(H->alloc, H->order);
+	H->parent_eid = NULL;
+	H->parent = NULL;
+	H->parent_index = NULL;
+	H->order = NULL;
+	H->cap = 0;
+	H->n = 0;
+	H->valid = 0;
+}
+
+size_t
+entity_hierarchy_memsize_(struct entity_hierarchy *H) {
+	return H->cap * (sizeof(uint64_t) + 3 * sizeof(int));
+}
+
+static void
+reserve(struct entity_hierarchy *H, int n) {
+	if (n <= H->cap)
+		return;
+	int cap = H->cap * 3 / 2;
+	if (cap < n)
+		cap = n;
+	H->parent_eid = (uint64_t *)ecs_realloc_(H->alloc, ECS_MEM_OTHER, H->parent_eid, cap * sizeof(uint64_t));
+	H->parent = (int *)ecs_realloc_(H->alloc, ECS_MEM_OTHER, H->parent, cap * sizeof(int));
+	H->parent_index = (int *)ecs_realloc_(H->alloc, ECS_MEM_OTHER, H->parent_index, cap * sizeof(int));
+	H->order = (int *)ecs_realloc_(H->alloc, ECS_MEM_OTHER, H->order, cap * sizeof(int));
+	H->cap = cap;
+}
+
+static inline uint64_t
+parent_eid(struct component_pool *c, int row) {
+	// the eid of parent is the first field (or column)
+	return *(uint64_t *)get_ptr(c, row);
+}
+
+// The parents are not changed since the last build
+static int
+unchanged(struct entity_world *w, struct entity_hierarchy *H, int cid) {
+	struct component_pool *c = &w->c[cid];
+	if (!H->valid || H->cid != cid || H->n != c->n
+		|| H->version != c->version || H->eid_version != w->eid.version)
+		return 0;
+	int i;
+	for (i = 0; i < c->n; i++) {
+		if (parent_eid(c, i) != H->parent_eid[i])
+			return 0;
+	}
+	return 1;
+}
+
+static void
+build(struct entity_world *w, struct entity_hierarchy *H, int cid) {
+	struct component_pool *c = &w->c[cid];
+	int n = c->n;
+	reserve(H, n);
+	int i;
+	int index = -1;
+	int row = -1;
+	for (i = 0; i < n; i++) {
+		uint64_t eid = parent_eid(c, i);
+		H->parent_eid[i] = eid;
+		H->parent[i] = -1;
+		H->parent_index[i] = -1;
+		if (eid == 0)
+			continue;
+		// siblings are often adjacent, reuse the last lookup
+		if (i == 0 || eid != H->parent_eid[i-1]) {
+			index = entity_id_find(&w->eid, eid);
+			row = index >= 0 ? ecs_lookup_component_(c, make_index_(index), row) : -1;
+		}
+		H->parent_index[i] = index;
+		H->parent[i] = row;
+	}
+	// count sort the children by the parent, then walk them level by level
+	int *first = (int *)ecs_malloc_(H->alloc, ECS_MEM_OTHER, (n + 1) * sizeof(int) + n * sizeof(int));
+	int *children = first + n + 1;
+	memset(first, 0, (n + 1) * sizeof(int));
+	for (i = 0; i < n; i++) {
+		if (H->parent[i] >= 0)
+			++first[H->parent[i] + 1];
+	}
+	for (i = 0; i < n; i++) {
+		first[i+1] += first[i];
+	}
+	for (i = 0; i < n; i++) {
+		int p = H->parent[i];
+		if (p >= 0)
+			children[first[p]++] = i;
+	}
+	// first[p] is the end of the children of p now
+	int m = 0;
+	for (i = 0; i < n; i++) {
+		if (H->parent[i] < 0)
+			H->order[m++] = i;
+	}
+	int head;
+	for (head = 0; head < m; head++) {
+		int p = H->order[head];
+		int j;
+		for (j = p > 0 ? first[p-1] : 0; j < first[p]; j++) {
+			H->order[m++] = children[j];
+		}
+	}
+	ecs_free_(H->alloc, first);
+	H->order_n = m;
+	H->n = n;
+	H->cid = cid;
+	H->version = c->version;
+	H->eid_version = w->eid.version;
+	H->valid = 1;
+}
+
+struct entity_hierarchy *
+entity_hierarchy_sync_(struct entity_world *w, int cid) {
+	if (cid < 0 || cid >= MAX_COMPONENT)
+		return NULL;
+	struct component_pool *c = &w->c[cid];
+	if (c->cap == 0 || c->stride < sizeof(uint64_t)
+		|| ((c->flags & POOL_SOA) && c->column[0].size < sizeof(uint64_t))) {
+		// Should be a C Componet with an eid (uint64)
+		return NULL;
+	}
+	ecs_flush_(w);
+	struct entity_hierarchy *H = &w->hierarchy;
+	if (!unchanged(w, H, cid))
+		build(w, H, cid);
+	return H;
+}
@@ -0,0 +1,31 @@
+#ifndef LUA_ECS_HIERARCHY_H
+#define LUA_ECS_HIERARCHY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct entity_world;
+struct ecs_allocator;
+
+// The parent -> children index of a C component whose first field is the eid of parent
+struct entity_hierarchy {
+	int valid;
+	int cid;
+	int n;	// rows of the pool
+	int cap;
+	int order_n;	// rows in order, the rows in cycles are excluded
+	unsigned int version;	// of the pool
+	uint32_t eid_version;
+	uint64_t *parent_eid;	// of each row, to find out the parents changed by writes
+	int *parent;	// row of the parent in the pool, -1 if the parent has not the component
+	int *parent_index;	// entity index of the parent, -1 if none
+	int *order;	// rows, the parents are before the children
+	struct ecs_allocator *alloc;
+};
+
+void entity_hierarchy_deinit_(struct entity_hierarchy *H);
+size_t entity_hierarchy_memsize_(struct entity_hierarchy *H);
+// Returns NULL if cid is not a C component with an eid
+struct entity_hierarchy * entity_hierarchy_sync_(struct entity_world *w, int cid);
+
+#endif
@@ -6,9 +6,11 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "ecs_alloc.h"
 #include "ecs_group.h"
 #include "ecs_entityindex.h"
 #include "ecs_entityid.h"
+#include "ecs_hierarchy.h"
 
 #define MAX_COMPONENT_NAME 32
 #define MAX_COMPONENT 256
@@ -30,13 +32,50 @@
 #define TYPE_USERDATA 8
 #define TYPE_COUNT 9
 
+#define POOL_SPARSE 1	// keep a reverse map (entity index -> pool index)
+#define POOL_SOA 2	// struct of arrays, each field in its own column
+#define POOL_PAGED 4	// C component in fixed size pages, pointers are stable while growing
+#define POOL_TRANSIENT 8	// buffer comes from the arena of world, it's dropped by w:clear_transient()
+#define POOL_CHANGED 16	// each component has a uint32_t version of the last write, in the array stamp
+#define POOL_BITSET 32	// tag in a bitset of entity index, the index of a tag is its entity index
+
+// Components added to older entities are staged after n, and merged later
+#define POOL_PENDING_MAX 1024
+
+#ifndef POOL_PAGE_SHIFT
+#define POOL_PAGE_SHIFT 10
+#endif
+#define POOL_PAGE_SIZE (1 << POOL_PAGE_SHIFT)
+#define POOL_PAGE_MASK (POOL_PAGE_SIZE - 1)
+
+struct pool_column {
+	int offset;	// offset of the field in struct, the column begins at offset * cap
+	int size;
+};
+
 struct component_pool {
 	int cap;
 	int n;
 	int stride; // -1 means lua object
 	int last_lookup;
+	int flags;
+	unsigned int version;	// bumped when the ids are changed (add, remove, tags)
+	int sparse_cap;
+	int *sparse;	// reverse map, -1 means absent. only for POOL_SPARSE
+	int column_n;
+	struct pool_column *column;	// only for POOL_SOA
+	void *record;	// for gathering/scattering a struct of POOL_SOA
+	int page_n;	// only for POOL_PAGED, buffer is the page directory then
+	int pending;	// staged components in [n, n + pending), unsorted
+	int align;	// alignment of buffer (and pages, columns), 0 is default
+	uint32_t *stamp;	// only for POOL_CHANGED, one for each row, after the data in buffer (or its own for POOL_PAGED)
+	struct ecs_allocator *alloc;
 	entity_index_t *id;
 	void *buffer;
+	uint64_t *bits;	// only for POOL_BITSET, cap is the number of bits then
+	uint64_t *tomb;	// only for tags, the disabled rows, they are dropped by ecs_tag_compact_
+	int tomb_cap;	// words of tomb
+	int tomb_n;	// the number of disabled rows
 };
 
 struct component_lua {
@@ -45,11 +84,24 @@ struct component_lua {
 	unsigned int cap;
 };
 
+struct update_stat {
+	unsigned int update;	// w:update() with removed entities
+	unsigned int merge;	// pools have removed components
+	unsigned int shift;	// pools only need to renumber
+	unsigned int skip;	// pools untouched
+};
+
 struct entity_world {
 	struct component_lua lua;
+	struct ecs_allocator alloc;
 	struct entity_id eid;
 	struct entity_group_arena group;
+	struct entity_hierarchy hierarchy;	// of the last propagated component
 	struct component_pool c[MAX_COMPONENT];
+	int pending;	// some pools may have staged components
+	uint64_t types[MAX_COMPONENT / 64];	// bitmask of registered types
+	uint32_t clock;	// the version of writes, it advances when a select with :changed begins
+	struct update_stat stat;
 };
 
 struct group_field {
@@ -63,13 +115,47 @@ struct group_key {
 	int id;
 	int field_n;
 	int attrib;
+	int cursor;	// position in the pool of the last lookup, it only moves forward in a join
+	unsigned int version;	// of the pool when the matches are cached
+};
+
+#define PRED_EQ 0
+#define PRED_NE 1
+#define PRED_LT 2
+#define PRED_LE 3
+#define PRED_GT 4
+#define PRED_GE 5
+
+// The predicate on a field of C component : field op value
+struct group_pred {
+	int key;
+	int offset;	// of the field, or the column for POOL_SOA
+	int type;
+	int op;
+	int isint;
+	int param;	// the value is the param-th one bound at select time, 0 : literal
+	int64_t i;
+	double n;
 };
 
 struct group_iter {
 	struct entity_world *world;
 	struct group_field *f;
+	struct group_pred *p;
 	int nkey;
+	int pred_n;
+	int param_n;	// the values of predicates bound at select time
 	int readonly;
+	int changed;	// has :changed keys
+	uint32_t since;	// :changed matches the components written after it
+	uint32_t clock;	// when the last select begins
+	int cache_n;	// the number of cached matches (in the 2nd user value), -1 : invalid
+	int record_n;
+	int columns_n;	// the matches of the last w:columns, -1 : invalid
+	int count_n;	// the number of matches counted without the cache, -1 : invalid
+	int serial;	// of the iteration which records the matches
+	unsigned int hit;
+	unsigned int miss;
 	struct group_key k[1];
 };
 
@@ -109,12 +195,123 @@ check_groupiter(lua_State *L, int index) {
 	return iter;
 }
 
+// For POOL_SOA, it's the element of the first column
 static inline void *
 get_ptr(struct component_pool *c, int index) {
-	if (c->stride > 0)
+	if (c->stride > 0) {
+		if (c->flags & POOL_SOA)
+			return (void *)((char *)c->buffer + c->column[0].size * index);
+		if (c->flags & POOL_PAGED)
+			return (void *)(((char **)c->buffer)[index >> POOL_PAGE_SHIFT] + c->stride * (index & POOL_PAGE_MASK));
 		return (void *)((char *)c->buffer + c->stride * index);
-	else
+	} else {
 		return DUMMY_PTR;
+	}
+}
+
+static inline void *
+get_column(struct component_pool *c, int column, int index) {
+	struct pool_column *col = &c->column[column];
+	return (void *)((char *)c->buffer + col->offset * c->cap + col->size * index);
+}
+
+// Read the whole struct, POOL_SOA gathers it into c->record
+static inline void *
+get_record(struct component_pool *c, int index) {
+	if (!(c->flags & POOL_SOA))
+		return get_ptr(c, index);
+	char *record = (char *)c->record;
+	int i;
+	for (i = 0; i < c->column_n; i++) {
+		struct pool_column *col = &c->column[i];
+		memcpy(record + col->offset, get_column(c, i, index), col->size);
+	}
+	return record;
+}
+
+// Write the whole struct back, POOL_SOA scatters it into columns
+static inline void
+set_record(struct component_pool *c, int index, const void *buffer) {
+	if (!(c->flags & POOL_SOA)) {
+		void *ptr = get_ptr(c, index);
+		if (ptr != buffer)
+			memcpy(ptr, buffer, c->stride);
+		return;
+	}
+	const char *record = (const char *)buffer;
+	int i;
+	for (i = 0; i < c->column_n; i++) {
+		struct pool_column *col = &c->column[i];
+		memcpy(get_column(c, i, index), record + col->offset, col->size);
+	}
+}
+
+static inline uint32_t *
+get_stamp(struct component_pool *c, int index) {
+	return &c->stamp[index];
+}
+
+// Mark the components [index, index + n) written
+static inline void
+ecs_touch_(struct entity_world *w, struct component_pool *c, int index, int n) {
+	if (c->flags & POOL_CHANGED) {
+		int i;
+		for (i = 0; i < n; i++) {
+			*get_stamp(c, index + i) = w->clock;
+		}
+	}
+}
+
+static inline void
+sparse_unset(struct component_pool *c, entity_index_t e) {
+	uint32_t idx = index_(e);
+	if (idx < c->sparse_cap)
+		c->sparse[idx] = -1;
+}
+
+static inline int
+bitset_test(const struct component_pool *c, int idx) {
+	return (unsigned)idx < (unsigned)c->cap && (c->bits[idx >> 6] >> (idx & 63) & 1);
+}
+
+// The first entity >= idx in the bitset, -1 if none
+static inline int
+bitset_next(const struct component_pool *c, int idx) {
+	if (idx < 0)
+		idx = 0;
+	if (idx >= c->cap)
+		return -1;
+	int i = idx >> 6;
+	int words = c->cap >> 6;
+	uint64_t word = c->bits[i] & (~(uint64_t)0 << (idx & 63));
+	while (word == 0) {
+		if (++i >= words)
+			return -1;
+		word = c->bits[i];
+	}
+	return i * 64 + __builtin_ctzll(word);
+}
+
+// The row of a tag is disabled, the id of it is kept until compacted
+static inline int
+tomb_test(const struct component_pool *c, int row) {
+	return c->tomb_n > 0 && (row >> 6) < c->tomb_cap && (c->tomb[row >> 6] >> (row & 63) & 1);
+}
+
+// The first live row >= row of a tag
+static inline int
+tomb_skip(const struct component_pool *c, int row) {
+	while (row < c->n && tomb_test(c, row))
+		++row;
+	return row;
+}
+
+static inline void
+tomb_reset(struct component_pool *c) {
+	if (c->tomb_n > 0) {
+		memset(c->tomb, 0, c->tomb_cap * sizeof(uint64_t));
+		c->tomb_n = 0;
+	}
 }
 
 static inline int
@@ -135,15 +332,34 @@ ENTITY_EID(struct entity_world *w, entity_index_t e) {
 static inline uint64_t
 ecs_get_eid(struct entity_world *w, int cid, int index) {
 	struct component_pool *c = &w->c[cid];
+	if (c->flags & POOL_BITSET)
+		return w->eid.id[index];
 	return w->eid.id[index_(c->id[index])];
 }
 
 int ecs_add_component_id_(struct entity_world *w, int cid, entity_index_t eindex);
+int ecs_append_component_n_(struct entity_world *w, int cid, uint32_t first, int n, const void *proto);
 void ecs_write_component_object_(lua_State *L, int n, struct group_field *f, void *buffer);
 void ecs_read_object_(lua_State *L, struct group_iter *iter, void *buffer);
 int ecs_lookup_component_(struct component_pool *pool, entity_index_t eindex, int guess_index);
+int ecs_seek_component_(struct component_pool *pool, int eid, int from);
+void ecs_sparse_sync_(struct component_pool *pool, int from);
+void ecs_sparse_rebuild_(struct component_pool *pool);
 entity_index_t ecs_new_entityid_(struct entity_world *w); 
 void ecs_reserve_component_(struct component_pool *pool, int cid, int cap);
 void ecs_reserve_eid_(struct entity_world *w, int n);
+void ecs_pool_flush_(struct component_pool *pool);
+void ecs_flush_pending_(struct entity_world *w);
+int ecs_bitset_set_(struct component_pool *pool, int idx);
+void ecs_bitset_clear_(struct component_pool *pool, int idx);
+void ecs_tag_disable_(struct component_pool *pool, int row);
+void ecs_tag_compact_(struct component_pool *pool);
+
+// Merge all the staged components before reading pools by position
+static inline void
+ecs_flush_(struct entity_world *w) {
+	if (w->pending)
+		ecs_flush_pending_(w);
+}
 
 #endif
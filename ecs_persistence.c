@@ -23,6 +23,25 @@ read_id(lua_State *L, FILE *f, entity_index_t *id, int n) {
 	return make_index_(last_id);
 }
 
+// Read the ids into the bitset
+static entity_index_t
+read_bitset(lua_State *L, FILE *f, struct component_pool *c, int n) {
+	entity_index_t id[1024];
+	uint32_t last_id = 0;
+	int i;
+	while (n > 0) {
+		int sn = n > 1024 ? 1024 : n;
+		if (fread(id, sizeof(entity_index_t), sn, f) != sn)
+			luaL_error(L, "Read id error");
+		for (i = 0; i < sn; i++) {
+			last_id += index_(id[i]);
+			ecs_bitset_set_(c, last_id);
+		}
+		n -= sn;
+	}
+	return make_index_(last_id);
+}
+
 static void
 read_data(lua_State *L, FILE *f, void *buffer, int stride, int n) {
 	size_t r = fread(buffer, stride, n, f);
@@ -30,6 +49,26 @@ read_data(lua_State *L, FILE *f, void *buffer, int stride, int n) {
 		luaL_error(L, "Read data error");
 }
 
+static void
+read_data_soa(lua_State *L, FILE *f, struct component_pool *c, int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		read_data(L, f, c->record, c->stride, 1);
+		set_record(c, i, c->record);
+	}
+}
+
+static void
+read_data_paged(lua_State *L, FILE *f, struct component_pool *c, int n) {
+	int i;
+	for (i = 0; i < n; i += POOL_PAGE_SIZE) {
+		int sn = n - i;
+		if (sn > POOL_PAGE_SIZE)
+			sn = POOL_PAGE_SIZE;
+		read_data(L, f, get_ptr(c, i), c->stride, sn);
+	}
+}
+
 static entity_index_t
 read_section(lua_State *L, struct file_reader *reader, struct component_pool *c, size_t offset, int stride, int n) {
 	if (reader->f == NULL)
@@ -40,7 +79,15 @@ read_section(lua_State *L, struct file_reader *reader, struct component_pool *c,
 	entity_index_t maxid;
 	if (stride > 0) {
 		maxid = read_id(L, reader->f, c->id, n);
-		read_data(L, reader->f, c->buffer, stride, n);
+		if (c->flags & POOL_SOA) {
+			read_data_soa(L, reader->f, c, n);
+		} else if (c->flags & POOL_PAGED) {
+			read_data_paged(L, reader->f, c, n);
+		} else {
+			read_data(L, reader->f, c->buffer, stride, n);
+		}
+	} else if (c->flags & POOL_BITSET) {
+		maxid = read_bitset(L, reader->f, c, n);
 	} else {
 		maxid = read_id(L, reader->f, c->id, n);
 	}
@@ -69,11 +116,20 @@ static int
 ecs_persistence_generate_eid(lua_State *L) {
 	struct entity_world *w = getW(L);
 	int i;
+	ecs_flush_(w);
 	int maxid = -1;
 	for (i=0;i<MAX_COMPONENT;i++) {
 		struct component_pool *c = &w->c[i];
 		if (c->n > 0) {
-			int m = index_(c->id[c->n-1]);
+			int m;
+			if (c->flags & POOL_BITSET) {
+				int word = c->cap >> 6;
+				while (c->bits[--word] == 0)
+					;
+				m = word * 64 + 63 - __builtin_clzll(c->bits[word]);
+			} else {
+				m = index_(c->id[c->n-1]);
+			}
 			if (m > maxid)
 				maxid = m;
 		}
@@ -84,9 +140,14 @@ ecs_persistence_generate_eid(lua_State *L) {
 	maxid++;
 	ecs_reserve_eid_(w, maxid);
 	w->eid.last_id = w->eid.n = maxid;
+	w->eid.free_n = 0;
+	++w->eid.version;
 	for (i=0;i<maxid;i++) {
 		w->eid.id[i] = (uint64_t)i+1;
+		if (w->eid.stable)
+			w->eid.id[i] = w->eid.id[i] << ENTITY_SLOT_BITS | i;
 	}
+	entity_id_rebuild(&w->eid);
 	return 0;
 }
 
@@ -102,24 +163,37 @@ ecs_persistence_readcomponent(lua_State *L) {
 	if (cid == ENTITYID_TAG) {
 		if (stride != -1)
 			return luaL_error(L, "Invalid eid");
+		if (w->eid.stable)
+			return luaL_error(L, "Can't read eid into a stable world");
 		ecs_reserve_eid_(w, n);
 		read_section_eid(L, reader, w->eid.id, offset, n);
 		w->eid.n = n;
 		w->eid.last_id = (n > 0) ? w->eid.id[n-1] : 0;
+		++w->eid.version;
+		entity_id_rebuild(&w->eid);
 		lua_pushinteger(L, n);
 		return 1;
 	} else {
 		check_cid_valid(L, w, cid);
 		struct component_pool *c = &w->c[cid];
+		ecs_pool_flush_(c);
 		if (c->n != 0) {
 			return luaL_error(L, "Component %d exists", cid);
 		}
 		if (c->stride != stride) {
 			return luaL_error(L, "Invalid component %d (%d != %d)", cid, c->stride, stride);
 		}
-		ecs_reserve_component_(c, cid, n);
-		entity_index_t maxid = read_section(L, reader, c, offset, stride, n);
-		c->n = n;
+		entity_index_t maxid;
+		if (c->flags & POOL_BITSET) {
+			maxid = read_section(L, reader, c, offset, stride, n);
+		} else {
+			ecs_reserve_component_(c, cid, n);
+			maxid = read_section(L, reader, c, offset, stride, n);
+			c->n = n;
+		}
+		++c->version;
+		ecs_touch_(w, c, 0, n);
+		ecs_sparse_rebuild_(c);
 		lua_pushinteger(L, index_(maxid));
 		return 1;
 	}
@@ -166,6 +240,22 @@ static void
 write_id(lua_State *L, struct file_writer *w, struct component_pool *c) {
 	int i;
 	uint32_t last_id = 0;
+	if (c->flags & POOL_BITSET) {
+		// The file format is the same as the sorted ids
+		entity_index_t id[1024];
+		int n = 0;
+		int idx = -1;
+		while ((idx = bitset_next(c, idx + 1)) >= 0) {
+			id[n++] = make_index_(idx);
+			if (n == 1024) {
+				last_id = write_id_(L, w, id, n, last_id);
+				n = 0;
+			}
+		}
+		if (n > 0)
+			write_id_(L, w, id, n, last_id);
+		return;
+	}
 	for (i = 0; i < c->n; i += 1024) {
 		int n = c->n - i;
 		if (n > 1024)
@@ -176,7 +266,30 @@ write_id(lua_State *L, struct file_writer *w, struct component_pool *c) {
 
 static void
 write_data(lua_State *L, struct file_writer *w, struct component_pool *c) {
-	size_t s = fwrite(c->buffer, c->stride, c->n, w->f);
+	size_t s;
+	if (c->flags & POOL_SOA) {
+		// The file format is always an array of records
+		int i;
+		for (i = 0; i < c->n; i++) {
+			if (fwrite(get_record(c, i), c->stride, 1, w->f) != 1)
+				break;
+		}
+		s = i;
+	} else if (c->flags & POOL_PAGED) {
+		int i;
+		s = 0;
+		for (i = 0; i < c->n; i += POOL_PAGE_SIZE) {
+			int n = c->n - i;
+			if (n > POOL_PAGE_SIZE)
+				n = POOL_PAGE_SIZE;
+			size_t r = fwrite(get_ptr(c, i), c->stride, n, w->f);
+			s += r;
+			if (r != n)
+				break;
+		}
+	} else {
+		s = fwrite(c->buffer, c->stride, c->n, w->f);
+	}
 	if (s != c->n) {
 		luaL_error(L, "Can't write section data %d:%d", c->n, c->stride);
 	}
@@ -230,6 +343,8 @@ lwrite_section(lua_State *L) {
 
 	int cid = luaL_checkinteger(L, 3);
 	if (cid == ENTITYID_TAG) {
+		if (world->eid.stable)
+			return luaL_error(L, "Can't write eid of a stable world");
 		s->stride = -1;	// It's eid
 		s->n = world->eid.n;
 		++w->n;
@@ -237,6 +352,8 @@ lwrite_section(lua_State *L) {
 	} else {
 		check_cid_valid(L, world, cid);
 		struct component_pool *c = &world->c[cid];
+		ecs_pool_flush_(c);
+		ecs_tag_compact_(c);
 		if (c->stride < 0) {
 			return luaL_error(L, "The component is not writable");
 		}
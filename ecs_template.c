@@ -135,7 +135,8 @@ ecs_template_instance_component(lua_State *L) {
 		if (sz != c->stride) {
 			return luaL_error(L, "Invalid unmarshal result");
 		}
-		memcpy(get_ptr(c, index), s, sz);
+		set_record(c, index, s);
+		ecs_touch_(w, c, index, 1);
 	}
 	return 0;
 }
@@ -1,6 +1,8 @@
 #ifdef TEST_LUAECS
 
 #include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
 #include "luaecs.h"
 
 #define COMPONENT_VECTOR2 1
@@ -127,6 +129,374 @@ lcache(lua_State *L) {
 	return 2;
 }
 
+static int
+lcolumnsum(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int cid = luaL_checkinteger(L, 2);
+	int offset = luaL_checkinteger(L, 3);
+	int stride;
+	char *p = (char *)entity_column(ctx, cid, offset, &stride);
+	if (p == NULL)
+		return 0;
+	int n = entity_count(ctx, cid);
+	int i;
+	float s = 0;
+	for (i = 0; i < n; i++) {
+		s += *(float *)p;
+		p += stride;
+	}
+	lua_pushnumber(L, s);
+	lua_pushinteger(L, stride);
+	return 2;
+}
+
+// Read the vector2 fields of a soa component by columns, the pointers are dummy
+static int
+lsoaread(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int cid = luaL_checkinteger(L, 2);
+	int index = luaL_checkinteger(L, 3);
+	struct ecs_token t = { -1 };
+	if (entity_fetch(ctx, cid, index, &t) == NULL || t.id < 0)
+		return luaL_error(L, "entity_fetch of soa should not be NULL");
+	if (entity_component(ctx, t, cid) == NULL)
+		return luaL_error(L, "entity_component of soa should not be NULL");
+	int cursor = 0;
+	if (entity_component_r(ctx, t, cid, &cursor) == NULL)
+		return luaL_error(L, "entity_component_r of soa should not be NULL");
+	int row = entity_component_index(ctx, t, cid);
+	int stride;
+	char *x = (char *)entity_column(ctx, cid, offsetof(struct vector2, x), &stride);
+	char *y = (char *)entity_column(ctx, cid, offsetof(struct vector2, y), &stride);
+	lua_pushnumber(L, *(float *)(x + row * stride));
+	lua_pushnumber(L, *(float *)(y + row * stride));
+	return 2;
+}
+
+// Iterate a tag by entity_next, and read it back by entity_fetch_r
+static int
+ltagnext(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int tag = luaL_checkinteger(L, 2);
+	struct ecs_token t, t2;
+	int n = 0;
+	int i;
+	for (i = entity_next(ctx, tag, -1, &t); i >= 0; i = entity_next(ctx, tag, i, &t)) {
+		if (entity_fetch_r(ctx, tag, i, &t2) == NULL || t2.id != t.id)
+			return luaL_error(L, "Invalid tag at %d", i);
+		++n;
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+// Fetch a tag by rows, the disabled rows are NULL but the token is set. returns the rows fetched and entity_count
+static int
+ltagfetch(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int tag = luaL_checkinteger(L, 2);
+	struct ecs_token t;
+	int n = 0;
+	int i;
+	for (i = 0; ; i++) {
+		t.id = -1;
+		if (entity_fetch(ctx, tag, i, &t) != NULL)
+			++n;
+		else if (t.id < 0)
+			break;
+	}
+	lua_pushinteger(L, n);
+	lua_pushinteger(L, entity_count(ctx, tag));
+	return 2;
+}
+
+// The tokens of the rows by entity_fetch, and entity_count. The pointers must be found by entity_component too
+static int
+ltokens(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int cid = luaL_checkinteger(L, 2);
+	struct ecs_token t;
+	void *ptr;
+	int i;
+	lua_newtable(L);
+	for (i = 0; (ptr = entity_fetch(ctx, cid, i, &t)); i++) {
+		if (entity_component(ctx, t, cid) != ptr)
+			return luaL_error(L, "entity_component mismatch at %d", i);
+		lua_pushinteger(L, t.id);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_pushinteger(L, entity_count(ctx, cid));
+	return 2;
+}
+
+static int
+lnewbatch(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int n = luaL_checkinteger(L, 2);
+	int cid[2] = {
+		luaL_checkinteger(L, 3),	// vector2
+		luaL_checkinteger(L, 4),	// tag
+	};
+	struct vector2 v = { luaL_checknumber(L, 5), luaL_checknumber(L, 6) };
+	const void *proto[2] = { &v, NULL };
+	struct ecs_token t;
+	if (entity_new_batch(ctx, n, 2, cid, proto, &t) != n)
+		return 0;
+	lua_pushinteger(L, t.id);
+	return 1;
+}
+
+static int
+lcolumnaddr(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int cid = luaL_checkinteger(L, 2);
+	int offset = luaL_checkinteger(L, 3);
+	int stride;
+	void *p = entity_column(ctx, cid, offset, &stride);
+	lua_pushinteger(L, (lua_Integer)(uintptr_t)p);
+	return 1;
+}
+
+// the first one is vector2, returns the count and the sum of x
+static int
+ljoin(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int n = lua_gettop(L) - 1;
+	int cid[8];
+	int index[8];
+	int i;
+	if (n < 1 || n > 8)
+		return luaL_error(L, "Invalid join");
+	for (i = 0; i < n; i++) {
+		cid[i] = luaL_checkinteger(L, i + 2);
+		index[i] = 0;
+	}
+	struct ecs_token t = { -1 };
+	int count = 0;
+	double s = 0;
+	while (entity_join(ctx, n, cid, index, &t)) {
+		struct vector2 *v = (struct vector2 *)entity_fetch(ctx, cid[0], index[0], NULL);
+		s += v->x;
+		++count;
+	}
+	lua_pushinteger(L, count);
+	lua_pushnumber(L, s);
+	return 2;
+}
+
+// the same as join, returns the number of spans too
+static int
+lspan(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int n = lua_gettop(L) - 1;
+	int cid[8];
+	int index[8];
+	void *ptr[8];
+	int i;
+	if (n < 1 || n > 8)
+		return luaL_error(L, "Invalid span");
+	for (i = 0; i < n; i++) {
+		cid[i] = luaL_checkinteger(L, i + 2);
+		index[i] = 0;
+	}
+	struct ecs_token t = { -1 };
+	int count = 0;
+	int span = 0;
+	double s = 0;
+	int r;
+	while ((r = entity_span(ctx, n, cid, index, ptr, &t))) {
+		struct vector2 *v = (struct vector2 *)ptr[0];
+		for (i = 0; i < r; i++) {
+			s += v[i].x;
+		}
+		count += r;
+		++span;
+	}
+	lua_pushinteger(L, count);
+	lua_pushnumber(L, s);
+	lua_pushinteger(L, span);
+	return 3;
+}
+
+static int
+ltagop(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int op = luaL_checkinteger(L, 2);
+	int dst = luaL_checkinteger(L, 3);
+	int n = lua_gettop(L) - 3;
+	int src[8];
+	int i;
+	if (n < 1 || n > 8)
+		return luaL_error(L, "Invalid tag op");
+	for (i = 0; i < n; i++) {
+		src[i] = luaL_checkinteger(L, i + 4);
+	}
+	lua_pushinteger(L, entity_tag_op(ctx, op, dst, n, src));
+	return 1;
+}
+
+struct node {
+	int64_t parent;
+	float x;
+	float world;
+};
+
+// world = world of parent + x, in the order of the hierarchy
+static int
+ltransform(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int cid = luaL_checkinteger(L, 2);
+	const int *order;
+	const int *parent;
+	int n = entity_hierarchy(ctx, cid, &order, &parent);
+	int i;
+	for (i = 0; i < n; i++) {
+		int row = order[i];
+		struct node *v = (struct node *)entity_fetch(ctx, cid, row, NULL);
+		v->world = v->x;
+		if (parent[row] >= 0) {
+			struct node *p = (struct node *)entity_fetch(ctx, cid, parent[row], NULL);
+			v->world += p->world;
+		}
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+#define MAX_WORKER 16
+
+struct worker {
+	pthread_t thread;
+	struct ecs_context *ctx;
+	const int *cid;	// vector2, tag, int
+	int driver;
+	int from;
+	int to;
+	int count;
+	double sum;
+};
+
+static void *
+worker_join(void *ud) {
+	struct worker *p = (struct worker *)ud;
+	struct ecs_context *ctx = p->ctx;
+	int index[2];
+	struct ecs_token t;
+	int cursor = 0;
+	int hint = 0;
+	entity_join_begin(ctx, 2, p->cid, p->driver, p->from, index, &t);
+	while (entity_join(ctx, 2, p->cid, index, &t) && index[p->driver] < p->to) {
+		struct vector2 *v = (struct vector2 *)entity_fetch(ctx, p->cid[0], index[0], NULL);
+		p->sum += v->x;
+		int *value = (int *)entity_component_r(ctx, t, p->cid[2], &cursor);
+		if (value)
+			p->sum += *value;
+		void *eid = entity_fetch(ctx, COMPONENT_EID, t.id, NULL);
+		if (entity_index_r(ctx, eid, &hint) != t.id)
+			p->sum = -1e30;
+		++p->count;
+	}
+	return NULL;
+}
+
+// join vector2 and tag in the workers, and sum vector2.x and the int component
+static int
+lparallel(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int n = luaL_checkinteger(L, 2);
+	int cid[3] = {
+		luaL_checkinteger(L, 3),
+		luaL_checkinteger(L, 4),
+		luaL_checkinteger(L, 5),
+	};
+	int range[MAX_WORKER + 1];
+	struct worker w[MAX_WORKER];
+	int i;
+	if (n < 1 || n > MAX_WORKER)
+		return luaL_error(L, "Invalid worker number %d", n);
+	int driver = entity_split(ctx, 2, cid, n, range);
+	for (i = 0; i < n; i++) {
+		struct worker *p = &w[i];
+		p->ctx = ctx;
+		p->cid = cid;
+		p->driver = driver;
+		p->from = range[i];
+		p->to = range[i+1];
+		p->count = 0;
+		p->sum = 0;
+		pthread_create(&p->thread, NULL, worker_join, p);
+	}
+	int count = 0;
+	double sum = 0;
+	for (i = 0; i < n; i++) {
+		pthread_join(w[i].thread, NULL);
+		count += w[i].count;
+		sum += w[i].sum;
+	}
+	lua_pushinteger(L, count);
+	lua_pushnumber(L, sum);
+	lua_pushinteger(L, driver);
+	return 3;
+}
+
+// the component at index is vector2, x += 1
+static int
+ltouch(lua_State *L) {
+	struct ecs_context *ctx = lua_touserdata(L, 1);
+	int cid = luaL_checkinteger(L, 2);
+	int index = luaL_checkinteger(L, 3);
+	// entity_fetch is a dummy pointer for soa, so write by the column
+	int stride;
+	char *x = (char *)entity_column(ctx, cid, offsetof(struct vector2, x), &stride);
+	if (x == NULL || index >= entity_count(ctx, cid))
+		return luaL_error(L, "Invalid index %d", index);
+	*(float *)(x + index * stride) += 1;
+	entity_changed(ctx, cid, index);
+	return 0;
+}
+
+// a userdata with the content of string
+static int
+lbuffer(lua_State *L) {
+	size_t sz;
+	const char *str = luaL_checklstring(L, 1, &sz);
+	void *ud = lua_newuserdatauv(L, sz, 0);
+	memcpy(ud, str, sz);
+	return 1;
+}
+
+static int
+lbytes(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+	lua_pushlstring(L, (const char *)lua_touserdata(L, 1), lua_rawlen(L, 1));
+	return 1;
+}
+
+static size_t test_alloc_bytes = 0;
+
+static void *
+test_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+	size_t *bytes = (size_t *)ud;
+	if (ptr == NULL)
+		osize = 0;
+	*bytes += nsize - osize;
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+static struct ecs_alloc_hook test_hook = { test_alloc, &test_alloc_bytes };
+
+// returns the hook and the bytes allocated by it
+static int
+lallochook(lua_State *L) {
+	lua_pushlightuserdata(L, &test_hook);
+	lua_pushinteger(L, test_alloc_bytes);
+	return 2;
+}
+
 LUAMOD_API int
 luaopen_ecs_ctest(lua_State *L) {
 	luaL_checkversion(L);
@@ -137,6 +507,22 @@ luaopen_ecs_ctest(lua_State *L) {
 		{ "getlua", lgetlua },
 		{ "siblinglua", lsiblinglua },
 		{ "cache", lcache },
+		{ "columnsum", lcolumnsum },
+		{ "newbatch", lnewbatch },
+		{ "columnaddr", lcolumnaddr },
+		{ "allochook", lallochook },
+		{ "join", ljoin },
+		{ "span", lspan },
+		{ "parallel", lparallel },
+		{ "tag_op", ltagop },
+		{ "soaread", lsoaread },
+		{ "tag_next", ltagnext },
+		{ "tag_fetch", ltagfetch },
+		{ "tokens", ltokens },
+		{ "transform", ltransform },
+		{ "touch", ltouch },
+		{ "buffer", lbuffer },
+		{ "bytes", lbytes },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L, l);
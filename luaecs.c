@@ -82,22 +82,44 @@ get_lua_component(lua_State *L, struct entity_world *w, struct component_pool *c
 }
 
 static void
-init_component_pool(struct entity_world *w, int index, int stride, int opt_size) {
+init_component_pool(struct entity_world *w, int index, int stride, int opt_size, int flags) {
 	struct component_pool *c = &w->c[index];
 	c->cap = opt_size;
 	c->n = 0;
 	c->stride = stride;
 	c->id = NULL;
 	c->last_lookup = 0;
+	c->flags = flags;
+	c->version = 0;
+	c->sparse_cap = 0;
+	c->sparse = NULL;
+	c->column_n = 0;
+	c->column = NULL;
+	c->record = NULL;
+	c->page_n = 0;
+	c->pending = 0;
+	c->align = 0;
+	c->stamp = NULL;
+	c->alloc = &w->alloc;
+	c->bits = NULL;
+	c->tomb = NULL;
+	c->tomb_cap = 0;
+	c->tomb_n = 0;
 	if (stride != STRIDE_TAG) {
 		c->buffer = NULL;
 	} else {
 		c->buffer = DUMMY_PTR;
 	}
+	if (flags & POOL_BITSET) {
+		c->cap = (opt_size + 63) & ~63;
+		size_t sz = (c->cap >> 6) * sizeof(uint64_t);
+		c->bits = (uint64_t *)ecs_malloc_(c->alloc, ECS_MEM_TAG, sz);
+		memset(c->bits, 0, sz);
+	}
 }
 
 static void
-entity_new_type(lua_State *L, int world_index, int cid, int stride, int opt_size) {
+entity_new_type(lua_State *L, int world_index, int cid, int stride, int opt_size, int flags) {
 	struct entity_world *w = (struct entity_world *)lua_touserdata(L, world_index);
 	if (opt_size <= 0) {
 		opt_size = DEFAULT_SIZE;
@@ -105,7 +127,48 @@ entity_new_type(lua_State *L, int world_index, int cid, int stride, int opt_size
 	if (cid < 0 || cid >= MAX_COMPONENT || w->c[cid].cap != 0) {
 		luaL_error(L, "Can't new type %d", cid);
 	}
-	init_component_pool(w, cid, stride, opt_size);
+	init_component_pool(w, cid, stride, opt_size, flags);
+	w->types[cid / 64] |= (uint64_t)1 << (cid % 64);
+}
+
+// columns : { offset1, size1, offset2, size2, ... }
+static void
+init_columns(lua_State *L, struct component_pool *c, int index) {
+	if (lua_type(L, index) != LUA_TTABLE) {
+		c->flags &= ~POOL_SOA;
+		luaL_checktype(L, index, LUA_TTABLE);
+	}
+	int n = lua_rawlen(L, index) / 2;
+	if (n == 0 || c->stride <= 0) {
+		c->flags &= ~POOL_SOA;
+		luaL_error(L, "soa layout needs fields");
+	}
+	int i;
+	int last = 0;
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, index, i * 2 + 1);
+		lua_rawgeti(L, index, i * 2 + 2);
+		int offset = lua_tointeger(L, -2);
+		int size = lua_tointeger(L, -1);
+		lua_pop(L, 2);
+		if (offset < last || (i == 0 && offset != 0) || size <= 0 || offset + size > c->stride) {
+			c->flags &= ~POOL_SOA;
+			luaL_error(L, "Invalid column %d", i + 1);
+		}
+		last = offset + size;
+	}
+	// the scratch record for gather/scatter follows the columns
+	struct pool_column *column = (struct pool_column *)ecs_malloc_(c->alloc, ECS_MEM_OTHER, n * sizeof(struct pool_column) + c->stride);
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, index, i * 2 + 1);
+		lua_rawgeti(L, index, i * 2 + 2);
+		column[i].offset = lua_tointeger(L, -2);
+		column[i].size = lua_tointeger(L, -1);
+		lua_pop(L, 2);
+	}
+	c->column_n = n;
+	c->column = column;
+	c->record = (void *)&column[n];
 }
 
 static int
@@ -113,7 +176,29 @@ lnew_type(lua_State *L) {
 	int cid = luaL_checkinteger(L, 2);
 	int stride = luaL_checkinteger(L, 3);
 	int size = luaL_optinteger(L, 4, 0);
-	entity_new_type(L, 1, cid, stride, size);
+	int flags = luaL_optinteger(L, 5, 0);
+	int align = luaL_optinteger(L, 7, 0);
+	if ((flags & POOL_PAGED) && (stride <= 0 || (flags & POOL_SOA))) {
+		return luaL_error(L, "Only C component in aos layout can be paged");
+	}
+	if ((flags & POOL_TRANSIENT) && (stride == STRIDE_LUA || (flags & (POOL_PAGED | POOL_SPARSE)))) {
+		return luaL_error(L, "Transient component can't be lua object, paged or sparse");
+	}
+	if ((flags & POOL_BITSET) && (stride != STRIDE_TAG || (flags & (POOL_SPARSE | POOL_TRANSIENT)))) {
+		return luaL_error(L, "Only tag can be bitset, and it can't be sparse or transient");
+	}
+	if (align != 0 && (stride <= 0 || align < 0 || align > ECS_MAX_ALIGN || (align & (align - 1)))) {
+		return luaL_error(L, "Invalid align %d", align);
+	}
+	if ((flags & POOL_CHANGED) && stride <= 0) {
+		return luaL_error(L, "Only C component can be changed");
+	}
+	entity_new_type(L, 1, cid, stride, size, flags);
+	struct component_pool *c = &getW(L)->c[cid];
+	c->align = align;
+	if (flags & POOL_SOA) {
+		init_columns(L, c, 6);
+	}
 	return 0;
 }
 
@@ -124,6 +209,7 @@ lcount_memory(lua_State *L) {
 	size_t sz = sizeof(*w);
 	sz += entity_id_memsize(&w->eid);
 	sz += entity_group_memsize_(&w->group);
+	sz += entity_hierarchy_memsize_(&w->hierarchy);
 	int i;
 	size_t msz = sz;
 	for (i = 0; i < MAX_COMPONENT; i++) {
@@ -131,6 +217,9 @@ lcount_memory(lua_State *L) {
 		if (c->id) {
 			sz += c->cap * sizeof(entity_index_t);
 			msz += c->n * sizeof(entity_index_t);
+		} else if (c->flags & POOL_BITSET) {
+			sz += c->cap / 8;
+			msz += c->cap / 8;
 		}
 		if (c->buffer != DUMMY_PTR) {
 			int stride = c->stride;
@@ -139,46 +228,108 @@ lcount_memory(lua_State *L) {
 			sz += c->cap * stride;
 			msz += c->n * stride;
 		}
+		if (c->flags & POOL_CHANGED) {
+			sz += c->cap * sizeof(uint32_t);
+			msz += c->n * sizeof(uint32_t);
+		}
+		if (c->flags & POOL_PAGED) {
+			// page directory
+			sz += c->page_n * sizeof(void *);
+			msz += c->page_n * sizeof(void *);
+		}
+		sz += c->sparse_cap * sizeof(int);
+		msz += c->sparse_cap * sizeof(int);
+		sz += c->tomb_cap * sizeof(uint64_t);
+		msz += c->tomb_cap * sizeof(uint64_t);
 	}
 	lua_pushinteger(L, sz);
 	lua_pushinteger(L, msz);
 	return 2;
 }
 
+static int
+lmemory_stat(lua_State *L) {
+	struct entity_world *w = getW(L);
+	static const char *category[ECS_MEM_COUNT] = {
+		"component", "tag", "sparse", "eid", "group", "other", "transient",
+	};
+	lua_createtable(L, 0, ECS_MEM_COUNT + 1);
+	size_t total = 0;
+	int i;
+	for (i = 0; i < ECS_MEM_COUNT; i++) {
+		total += w->alloc.bytes[i];
+		lua_pushinteger(L, w->alloc.bytes[i]);
+		lua_setfield(L, -2, category[i]);
+	}
+	lua_pushinteger(L, total);
+	lua_setfield(L, -2, "total");
+	return 1;
+}
+
+static inline void *
+pool_alloc(struct component_pool *pool, int cat, size_t sz) {
+	if (pool->flags & POOL_TRANSIENT)
+		return ecs_arena_alloc_(pool->alloc, sz, pool->align);
+	return ecs_malloc_aligned_(pool->alloc, cat, sz, pool->align);
+}
+
+static inline void
+pool_free(struct component_pool *pool, void *ptr) {
+	if (!(pool->flags & POOL_TRANSIENT))
+		ecs_free_(pool->alloc, ptr);
+}
+
 static void
 init_buffers(struct component_pool *pool) {
-	int cap = pool->cap;
 	int stride = pool->stride;
-	if (stride <= 0) {
+	if (stride == STRIDE_TAG) {
 		// only id
-		size_t id_sz = sizeof(entity_index_t) * cap;
-		pool->id = (entity_index_t *)malloc(id_sz);
-		if (stride == STRIDE_LUA) {
-			stride = sizeof(unsigned int);
-		} else {
-			return;
-		}
+		size_t id_sz = sizeof(entity_index_t) * pool->cap;
+		pool->id = (entity_index_t *)pool_alloc(pool, ECS_MEM_TAG, id_sz);
+		return;
 	}
-	size_t offset = stride * cap;
-	size_t sz = offset + sizeof(entity_index_t) * cap;
-	pool->buffer = malloc(sz);
-	pool->id = (entity_index_t *)((uint8_t *)pool->buffer + offset);
+	if (stride == STRIDE_LUA) {
+		stride = sizeof(unsigned int);
+	} else if (pool->align && (pool->flags & POOL_SOA)) {
+		// each column begins at offset * cap, so cap is a multiple of align
+		pool->cap = (pool->cap + pool->align - 1) & ~(pool->align - 1);
+	}
+	int cap = pool->cap;
+	// keep id aligned
+	size_t offset = (stride * cap + 3) & ~(size_t)3;
+	size_t stamp_sz = (pool->flags & POOL_CHANGED) ? sizeof(uint32_t) * cap : 0;
+	size_t sz = offset + stamp_sz + sizeof(entity_index_t) * cap;
+	pool->buffer = pool_alloc(pool, ECS_MEM_COMPONENT, sz);
+	if (stamp_sz)
+		pool->stamp = (uint32_t *)((uint8_t *)pool->buffer + offset);
+	pool->id = (entity_index_t *)((uint8_t *)pool->buffer + offset + stamp_sz);
 }
 
 static void
-move_buffers(struct component_pool *pool, void *buffer, entity_index_t *id) {
+move_buffers(struct component_pool *pool, void *buffer, entity_index_t *id, uint32_t *stamp, int old_cap) {
 	memcpy(pool->id, id, pool->n * sizeof(entity_index_t));
+	if (stamp)
+		memcpy(pool->stamp, stamp, pool->n * sizeof(uint32_t));
 	int stride = pool->stride;
 	if (stride <= 0) {
 		if (stride == STRIDE_LUA) {
 			stride = sizeof(unsigned int);
 		} else {
-			free(id);
+			pool_free(pool, id);
 			return;
 		}
 	}
-	memcpy(pool->buffer, buffer, pool->n * stride);
-	free(buffer);
+	if (pool->flags & POOL_SOA) {
+		// the columns move as cap changes
+		int i;
+		for (i = 0; i < pool->column_n; i++) {
+			struct pool_column *col = &pool->column[i];
+			memcpy((char *)pool->buffer + col->offset * pool->cap, (char *)buffer + col->offset * old_cap, pool->n * col->size);
+		}
+	} else {
+		memcpy(pool->buffer, buffer, pool->n * stride);
+	}
+	pool_free(pool, buffer);
 }
 
 static void
@@ -188,14 +339,98 @@ free_buffers(struct component_pool *c) {
 		if (stride == STRIDE_LUA) {
 			stride = sizeof(unsigned int);
 		} else {
-			free(c->id);
+			pool_free(c, c->id);
 			c->id = NULL;
 			return;
 		}
 	}
-	free(c->buffer);
+	pool_free(c, c->buffer);
 	c->buffer = NULL;
 	c->id = NULL;
+	c->stamp = NULL;
+}
+
+// Drop all the transient components, and reset the arena
+static void
+clear_transient(struct entity_world *w) {
+	int i;
+	for (i = 0; i < MAX_COMPONENT; i++) {
+		struct component_pool *c = &w->c[i];
+		if (c->flags & POOL_TRANSIENT) {
+			c->n = 0;
+			++c->version;
+			c->pending = 0;
+			c->id = NULL;
+			c->stamp = NULL;
+			tomb_reset(c);
+			if (c->stride != STRIDE_TAG)
+				c->buffer = NULL;
+		}
+	}
+	ecs_arena_reset_(&w->alloc);
+}
+
+// Pages are never moved, only the directory and the ids are reallocated
+static void
+paged_resize(struct component_pool *pool, int cap) {
+	int page_n = (cap + POOL_PAGE_MASK) >> POOL_PAGE_SHIFT;
+	if (page_n == 0)
+		page_n = 1;
+	char **page = (char **)pool->buffer;
+	int i;
+	for (i = page_n; i < pool->page_n; i++) {
+		ecs_free_(pool->alloc, page[i]);
+	}
+	page = (char **)ecs_realloc_(pool->alloc, ECS_MEM_COMPONENT, page, page_n * sizeof(char *));
+	for (i = pool->page_n; i < page_n; i++) {
+		page[i] = (char *)ecs_malloc_aligned_(pool->alloc, ECS_MEM_COMPONENT, pool->stride * POOL_PAGE_SIZE, pool->align);
+	}
+	pool->buffer = (void *)page;
+	pool->page_n = page_n;
+	pool->cap = page_n << POOL_PAGE_SHIFT;
+	pool->id = (entity_index_t *)ecs_realloc_(pool->alloc, ECS_MEM_COMPONENT, pool->id, pool->cap * sizeof(entity_index_t));
+	if (pool->flags & POOL_CHANGED)
+		pool->stamp = (uint32_t *)ecs_realloc_(pool->alloc, ECS_MEM_COMPONENT, pool->stamp, pool->cap * sizeof(uint32_t));
+}
+
+static void
+paged_free(struct component_pool *pool) {
+	char **page = (char **)pool->buffer;
+	int i;
+	for (i = 0; i < pool->page_n; i++) {
+		ecs_free_(pool->alloc, page[i]);
+	}
+	ecs_free_(pool->alloc, page);
+	ecs_free_(pool->alloc, pool->id);
+	ecs_free_(pool->alloc, pool->stamp);
+	pool->buffer = NULL;
+	pool->id = NULL;
+	pool->stamp = NULL;
+	pool->page_n = 0;
+}
+
+// Make room at index, shift [index, n) by one across the pages
+static void
+paged_insert(struct component_pool *pool, int index) {
+	int stride = pool->stride;
+	int last = pool->n;
+	while (last > index) {
+		int from = last & ~POOL_PAGE_MASK;
+		if (from <= index) {
+			memmove(get_ptr(pool, index + 1), get_ptr(pool, index), (last - index) * stride);
+			break;
+		}
+		memmove(get_ptr(pool, from + 1), get_ptr(pool, from), (last - from) * stride);
+		memcpy(get_ptr(pool, from), get_ptr(pool, from - 1), stride);
+		last = from - 1;
+	}
+}
+
+// The stamps are in one array, even for POOL_PAGED
+static inline void
+stamp_insert(struct component_pool *pool, int index) {
+	if (pool->flags & POOL_CHANGED)
+		memmove(&pool->stamp[index + 1], &pool->stamp[index], (pool->n - index) * sizeof(uint32_t));
 }
 
 void
@@ -203,14 +438,20 @@ ecs_reserve_eid_(struct entity_world *w, int n) {
 	if (w->eid.cap >= n) {
 		return;
 	}
-	free(w->eid.id);
-	w->eid.id = (uint64_t *)malloc(n * sizeof(uint64_t));
+	ecs_free_(&w->alloc, w->eid.id);
+	w->eid.id = (uint64_t *)ecs_malloc_(&w->alloc, ECS_MEM_EID, n * sizeof(uint64_t));
 	w->eid.n = 0;
 	w->eid.cap = n;
 }
 
 void
 ecs_reserve_component_(struct component_pool *pool, int cid, int cap) {
+	if (pool->flags & POOL_PAGED) {
+		if (pool->id == NULL || cap > pool->cap) {
+			paged_resize(pool, cap > pool->cap ? cap : pool->cap);
+		}
+		return;
+	}
 	if (pool->n == 0) {
 		if (cap > pool->cap) {
 			free_buffers(pool);
@@ -220,11 +461,13 @@ ecs_reserve_component_(struct component_pool *pool, int cid, int cap) {
 			init_buffers(pool);
 		}
 	} else if (cap > pool->cap) {
+		int old_cap = pool->cap;
 		pool->cap = cap;
 		void *buffer = pool->buffer;
 		entity_index_t *id = pool->id;
+		uint32_t *stamp = pool->stamp;
 		init_buffers(pool);
-		move_buffers(pool, buffer, id);
+		move_buffers(pool, buffer, id, stamp, old_cap);
 	}
 }
 
@@ -239,6 +482,7 @@ static int
 lcollect_memory(lua_State *L) {
 	struct entity_world *w = getW(L);
 	int i;
+	ecs_flush_(w);
 	for (i = 0; i < MAX_COMPONENT; i++) {
 		shrink_component_pool(L, &w->c[i], i);
 	}
@@ -248,6 +492,15 @@ lcollect_memory(lua_State *L) {
 static inline void
 expand_pool(struct component_pool *pool) {
 	int cap = pool->cap;
+	if (pool->flags & POOL_PAGED) {
+		// one more page
+		if (pool->id == NULL) {
+			paged_resize(pool, cap);
+		} else if (pool->n >= cap) {
+			paged_resize(pool, cap + 1);
+		}
+		return;
+	}
 	if (pool->n == 0) {
 		if (pool->id == NULL) {
 			init_buffers(pool);
@@ -257,16 +510,278 @@ expand_pool(struct component_pool *pool) {
 		pool->cap = cap * 3 / 2 + 1;
 		void *buffer = pool->buffer;
 		entity_index_t *id = pool->id;
+		uint32_t *stamp = pool->stamp;
 		init_buffers(pool);
-		move_buffers(pool, buffer, id);
+		move_buffers(pool, buffer, id, stamp, cap);
+	}
+}
+
+static void
+sparse_reserve(struct component_pool *pool, uint32_t n) {
+	if (n <= pool->sparse_cap)
+		return;
+	int cap = pool->sparse_cap * 3 / 2 + 1;
+	if (cap < n)
+		cap = n;
+	if (cap < DEFAULT_SIZE)
+		cap = DEFAULT_SIZE;
+	pool->sparse = (int *)ecs_realloc_(pool->alloc, ECS_MEM_SPARSE, pool->sparse, cap * sizeof(int));
+	// -1 (0xffffffff) : absent
+	memset(pool->sparse + pool->sparse_cap, 0xff, (cap - pool->sparse_cap) * sizeof(int));
+	pool->sparse_cap = cap;
+}
+
+// update reverse map of [from, pool->n)
+void
+ecs_sparse_sync_(struct component_pool *pool, int from) {
+	if (!(pool->flags & POOL_SPARSE))
+		return;
+	int n = pool->n;
+	if (n == 0)
+		return;
+	sparse_reserve(pool, index_(pool->id[n-1]) + 1);
+	int *sparse = pool->sparse;
+	int i;
+	for (i = from; i < n; i++) {
+		if (!tomb_test(pool, i))
+			sparse[index_(pool->id[i])] = i;
+	}
+}
+
+void
+ecs_sparse_rebuild_(struct component_pool *pool) {
+	if (!(pool->flags & POOL_SPARSE))
+		return;
+	if (pool->sparse)
+		memset(pool->sparse, 0xff, pool->sparse_cap * sizeof(int));
+	ecs_sparse_sync_(pool, 0);
+}
+
+static void
+bitset_reserve(struct component_pool *pool, int idx) {
+	if (idx < pool->cap)
+		return;
+	int cap = pool->cap * 3 / 2;
+	if (cap <= idx)
+		cap = idx + 1;
+	cap = (cap + 63) & ~63;
+	pool->bits = (uint64_t *)ecs_realloc_(pool->alloc, ECS_MEM_TAG, pool->bits, (cap >> 6) * sizeof(uint64_t));
+	memset(pool->bits + (pool->cap >> 6), 0, ((cap - pool->cap) >> 6) * sizeof(uint64_t));
+	pool->cap = cap;
+}
+
+// Returns 1 if the tag is new
+int
+ecs_bitset_set_(struct component_pool *pool, int idx) {
+	bitset_reserve(pool, idx);
+	uint64_t *word = &pool->bits[idx >> 6];
+	uint64_t mask = (uint64_t)1 << (idx & 63);
+	if (*word & mask)
+		return 0;
+	*word |= mask;
+	++pool->n;
+	++pool->version;
+	return 1;
+}
+
+void
+ecs_bitset_clear_(struct component_pool *pool, int idx) {
+	if (bitset_test(pool, idx)) {
+		pool->bits[idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+		--pool->n;
+		++pool->version;
+	}
+}
+
+// The entity of the nth tag in the bitset, -1 if n is out of range
+static int
+bitset_select(struct component_pool *pool, int n) {
+	int words = pool->cap >> 6;
+	int i;
+	for (i = 0; i < words; i++) {
+		uint64_t word = pool->bits[i];
+		int c = __builtin_popcountll(word);
+		if (n < c) {
+			while (n-- > 0)
+				word &= word - 1;
+			return i * 64 + __builtin_ctzll(word);
+		}
+		n -= c;
+	}
+	return -1;
+}
+
+static int binary_search(entity_index_t *a, int from, int to, uint32_t v);
+static inline int lower_bound(entity_index_t *a, int from, int to, int v);
+
+// Disable the tag at row in O(1), the row is skipped by the iterations and lookups until compacted
+void
+ecs_tag_disable_(struct component_pool *pool, int row) {
+	if (tomb_test(pool, row))
+		return;
+	if (pool->flags & POOL_SPARSE)
+		sparse_unset(pool, pool->id[row]);
+	++pool->version;
+	if (row == pool->n - 1) {
+		// drop the disabled rows at the end, so the last row is always alive
+		while (row > 0 && tomb_test(pool, row - 1)) {
+			--row;
+			pool->tomb[row >> 6] &= ~((uint64_t)1 << (row & 63));
+			--pool->tomb_n;
+		}
+		pool->n = row;
+		return;
+	}
+	if ((row >> 6) >= pool->tomb_cap) {
+		int cap = (pool->cap + 63) >> 6;
+		pool->tomb = (uint64_t *)ecs_realloc_(pool->alloc, ECS_MEM_TAG, pool->tomb, cap * sizeof(uint64_t));
+		memset(pool->tomb + pool->tomb_cap, 0, (cap - pool->tomb_cap) * sizeof(uint64_t));
+		pool->tomb_cap = cap;
+	}
+	pool->tomb[row >> 6] |= (uint64_t)1 << (row & 63);
+	++pool->tomb_n;
+}
+
+// Drop the disabled rows of a tag, it's called by w:update() and when there are too many of them
+void
+ecs_tag_compact_(struct component_pool *pool) {
+	if (pool->tomb_n == 0)
+		return;
+	int i = 0;
+	while (!tomb_test(pool, i))
+		++i;
+	int from = i;
+	int n = i;
+	for (; i < pool->n; i++) {
+		if (!tomb_test(pool, i))
+			pool->id[n++] = pool->id[i];
+	}
+	pool->n = n;
+	tomb_reset(pool);
+	++pool->version;
+	ecs_sparse_sync_(pool, from);
+}
+
+static inline void
+tomb_unset(struct component_pool *pool, int row) {
+	pool->tomb[row >> 6] &= ~((uint64_t)1 << (row & 63));
+	--pool->tomb_n;
+	++pool->version;
+}
+
+// The first disabled row >= row, or n if none
+static int
+tomb_next(const struct component_pool *pool, int row) {
+	int i = row >> 6;
+	if (i >= pool->tomb_cap)
+		return pool->n;
+	uint64_t word = pool->tomb[i] & (~(uint64_t)0 << (row & 63));
+	while (word == 0) {
+		if (++i >= pool->tomb_cap)
+			return pool->n;
+		word = pool->tomb[i];
+	}
+	return i * 64 + __builtin_ctzll(word);
+}
+
+// The last disabled row < row, or -1 if none
+static int
+tomb_prev(const struct component_pool *pool, int row) {
+	if (row <= 0)
+		return -1;
+	--row;
+	int i = row >> 6;
+	uint64_t word;
+	if (i >= pool->tomb_cap) {
+		i = pool->tomb_cap - 1;
+		word = pool->tomb[i];
+	} else {
+		word = pool->tomb[i] & (~(uint64_t)0 >> (63 - (row & 63)));
+	}
+	while (word == 0) {
+		if (--i < 0)
+			return -1;
+		word = pool->tomb[i];
+	}
+	return i * 64 + 63 - __builtin_clzll(word);
+}
+
+// Insert a tag into the pool with disabled rows. Revive the row of eid, or move the ids to the nearest disabled row.
+// Returns -1 if it should be inserted as usual.
+static int
+tomb_insert(struct component_pool *pool, entity_index_t eid) {
+	int n = pool->n;
+	int pos = lower_bound(pool->id, 0, n, index_(eid));
+	if (pos < n && ENTITY_INDEX_CMP(pool->id[pos], eid) == 0) {
+		if (tomb_test(pool, pos)) {
+			tomb_unset(pool, pos);
+			if (pool->flags & POOL_SPARSE) {
+				sparse_reserve(pool, index_(eid) + 1);
+				pool->sparse[index_(eid)] = pos;
+			}
+		}
+		return pos;
+	}
+	if (pos == n)
+		return -1;
+	if (pool->tomb_n * 2 > n) {
+		ecs_tag_compact_(pool);
+		return -1;
+	}
+	int t = tomb_next(pool, pos);
+	if (t < n) {
+		// move [pos, t) -> [pos + 1, t]
+		memmove(&pool->id[pos + 1], &pool->id[pos], (t - pos) * sizeof(pool->id[0]));
+	} else {
+		// move (t, pos) -> [t, pos - 1)
+		t = tomb_prev(pool, pos);
+		memmove(&pool->id[t], &pool->id[t + 1], (pos - 1 - t) * sizeof(pool->id[0]));
+		--pos;
+	}
+	pool->id[pos] = eid;
+	tomb_unset(pool, t);
+	ecs_sparse_sync_(pool, pos < t ? pos : t);
+	return pos;
+}
+
+// Put eid after n, it's faster than inserting into the middle of the pool
+static int
+stage_component_id_(struct component_pool *pool, entity_index_t eid) {
+	if (binary_search(pool->id, 0, pool->n, index_(eid)) >= 0)
+		return -1;
+	int i;
+	int from = pool->n;
+	int to = from + pool->pending;
+	for (i = from; i < to; i++) {
+		if (ENTITY_INDEX_CMP(pool->id[i], eid) == 0)
+			return -1;
 	}
+	pool->id[to] = eid;
+	++pool->pending;
+	return to;
 }
 
 static inline int
 add_component_id_(struct component_pool *pool, int cid, entity_index_t eid) {
+	if (pool->flags & POOL_BITSET) {
+		ecs_bitset_set_(pool, index_(eid));
+		return index_(eid);
+	}
+	if (pool->pending > 0 && (pool->n + pool->pending >= pool->cap || pool->pending >= POOL_PENDING_MAX)) {
+		ecs_pool_flush_(pool);
+	}
+	if (pool->tomb_n > 0) {
+		int index = tomb_insert(pool, eid);
+		if (index >= 0)
+			return index;
+	}
 	expand_pool(pool);
 	int index = pool->n;
 	int cmp;
+	if (pool->stride != STRIDE_TAG && index > 0
+		&& (pool->pending > 0 || ENTITY_INDEX_CMP(pool->id[index-1], eid) >= 0)) {
+		return stage_component_id_(pool, eid);
+	}
 	if (index > 0 && (cmp = ENTITY_INDEX_CMP(pool->id[index-1], eid)) >= 0) {
 		do {
 			if (cmp == 0) {
@@ -281,36 +796,201 @@ add_component_id_(struct component_pool *pool, int cid, entity_index_t eid) {
 		int stride = pool->stride;
 		if (stride == STRIDE_LUA)
 			stride = sizeof(unsigned int);
-		if (stride > 0) {
+		if (pool->flags & POOL_SOA) {
+			int i;
+			for (i = 0; i < pool->column_n; i++) {
+				int size = pool->column[i].size;
+				memmove(get_column(pool, i, index + 1), get_column(pool, i, index), (pool->n - index) * size);
+			}
+		} else if (pool->flags & POOL_PAGED) {
+			paged_insert(pool, index);
+		} else if (stride > 0) {
 			memmove((uint8_t *)pool->buffer + (index+1) * stride,
 				(uint8_t *)pool->buffer + index * stride,
 				(pool->n - index) * stride);
 		}
+		stamp_insert(pool, index);
 	}
 	pool->id[index] = eid;
 	++pool->n;
+	++pool->version;
+	ecs_sparse_sync_(pool, index);
 	return index;
 }
 
 int
 ecs_add_component_id_(struct entity_world *w, int cid, entity_index_t eid) {
 	struct component_pool *pool = &w->c[cid];
-	return add_component_id_(pool, cid, eid);
+	int index = add_component_id_(pool, cid, eid);
+	if (pool->pending)
+		w->pending = 1;
+	if (index >= 0)
+		ecs_touch_(w, pool, index, 1);
+	return index;
+}
+
+struct pending_item {
+	uint32_t id;
+	int slot;
+};
+
+static int
+compar_pending(const void *a, const void *b) {
+	const struct pending_item *pa = (const struct pending_item *)a;
+	const struct pending_item *pb = (const struct pending_item *)b;
+	return (pa->id > pb->id) - (pa->id < pb->id);
+}
+
+static inline void move_item(struct component_pool *pool, int from, int to, int delta);
+static inline void move_lua(struct component_pool *pool, int from, int to, int delta);
+
+// Merge [n, n + pending) into [0, n) in one pass from the end
+void
+ecs_pool_flush_(struct component_pool *pool) {
+	int p = pool->pending;
+	if (p == 0)
+		return;
+	int n = pool->n;
+	int stride = pool->stride;
+	if (stride == STRIDE_LUA)
+		stride = sizeof(unsigned int);
+	int changed = pool->flags & POOL_CHANGED;
+	size_t stamp_sz = changed ? sizeof(uint32_t) : 0;
+	struct pending_item *item = (struct pending_item *)ecs_malloc_(pool->alloc, ECS_MEM_OTHER, p * (sizeof(struct pending_item) + stamp_sz + stride));
+	uint32_t *stamp = (uint32_t *)&item[p];
+	char *data = (char *)&item[p] + p * stamp_sz;
+	int i;
+	for (i = 0; i < p; i++) {
+		item[i].id = index_(pool->id[n + i]);
+		item[i].slot = i;
+		if (changed)
+			stamp[i] = pool->stamp[n + i];
+		if (pool->stride == STRIDE_LUA) {
+			memcpy(data + i * stride, (unsigned int *)pool->buffer + n + i, stride);
+		} else {
+			memcpy(data + i * stride, get_record(pool, n + i), stride);
+		}
+	}
+	qsort(item, p, sizeof(struct pending_item), compar_pending);
+	int j = p - 1;
+	int k = n + p - 1;
+	i = n - 1;
+	while (j >= 0) {
+		if (i >= 0 && index_(pool->id[i]) > item[j].id) {
+			if (pool->stride == STRIDE_LUA) {
+				move_lua(pool, i, k, 0);
+			} else {
+				move_item(pool, i, k, 0);
+			}
+			--i;
+		} else {
+			const char *src = data + item[j].slot * stride;
+			pool->id[k] = make_index_(item[j].id);
+			if (changed)
+				pool->stamp[k] = stamp[item[j].slot];
+			if (pool->stride == STRIDE_LUA) {
+				memcpy((unsigned int *)pool->buffer + k, src, stride);
+			} else {
+				set_record(pool, k, src);
+			}
+			--j;
+		}
+		--k;
+	}
+	ecs_free_(pool->alloc, item);
+	pool->n = n + p;
+	pool->pending = 0;
+	++pool->version;
+	ecs_sparse_sync_(pool, k + 1);
+}
+
+void
+ecs_flush_pending_(struct entity_world *w) {
+	int i;
+	for (i = 0; i < MAX_COMPONENT; i++) {
+		ecs_pool_flush_(&w->c[i]);
+	}
+	w->pending = 0;
+}
+
+// Copy the struct at proto into [from, from + n)
+static void
+fill_component(struct component_pool *pool, int from, int n, const void *proto) {
+	if (pool->flags & (POOL_SOA | POOL_PAGED)) {
+		int i;
+		for (i = 0; i < n; i++) {
+			set_record(pool, from + i, proto);
+		}
+		return;
+	}
+	int stride = pool->stride;
+	char *ptr = (char *)get_ptr(pool, from);
+	memcpy(ptr, proto, stride);
+	int filled = 1;
+	while (filled < n) {
+		int c = n - filled;
+		if (c > filled)
+			c = filled;
+		memcpy(ptr + filled * stride, ptr, c * stride);
+		filled += c;
+	}
+}
+
+// Append components of the entities [first, first + n) , they must be newer than any one in the pool.
+// Returns the index of the first component
+int
+ecs_append_component_n_(struct entity_world *w, int cid, uint32_t first, int n, const void *proto) {
+	struct component_pool *pool = &w->c[cid];
+	int i;
+	if (pool->flags & POOL_BITSET) {
+		for (i = 0; i < n; i++) {
+			ecs_bitset_set_(pool, first + i);
+		}
+		return first;
+	}
+	ecs_pool_flush_(pool);
+	int index = pool->n;
+	if (pool->id == NULL || index + n > pool->cap) {
+		int cap = pool->cap * 3 / 2 + 1;
+		if (cap < index + n)
+			cap = index + n;
+		ecs_reserve_component_(pool, cid, cap);
+	}
+	for (i = 0; i < n; i++) {
+		pool->id[index + i] = make_index_(first + i);
+	}
+	pool->n += n;
+	++pool->version;
+	ecs_sparse_sync_(pool, index);
+	if (proto && pool->stride > 0) {
+		fill_component(pool, index, n, proto);
+	}
+	ecs_touch_(w, pool, index, n);
+	return index;
 }
 
 void *
 entity_component_temp_(struct entity_world *w, int tag, int cid) {
 	struct component_pool *t = &w->c[tag];
 	struct component_pool *pool = &w->c[cid];
+	ecs_pool_flush_(pool);
 	if (pool->n == t->n) {
 		if (entity_new_(w, tag, NULL) < 0)
 			return NULL;
 	} else if (pool->n > t->n) {
 		return NULL;
 	}
+	int e = (t->flags & POOL_BITSET) ? bitset_select(t, pool->n) : (int)index_(t->id[pool->n]);
+	if (pool->flags & POOL_BITSET) {
+		ecs_bitset_set_(pool, e);
+		return DUMMY_PTR;
+	}
 	expand_pool(pool);
 	int index = pool->n++;
-	pool->id[index] = t->id[index];
+	++pool->version;
+	pool->id[index] = make_index_(e);
+	ecs_sparse_sync_(pool, index);
+	ecs_touch_(w, pool, index, 1);
 	return get_ptr(pool, index);
 }
 
@@ -338,6 +1018,56 @@ lnew_entity(lua_State *L) {
 	return 2;
 }
 
+// Clone the newest entity n times, or any entity in stable mode (its slot may be reused)
+static int
+lclone_entity(lua_State *L) {
+	struct entity_world *w = getW(L);
+	uint32_t index = luaL_checkinteger(L, 2);
+	int n = luaL_checkinteger(L, 3);
+	int stable = w->eid.stable;
+	if (stable ? (index >= w->eid.n || entity_id_isfree(&w->eid, index)) : (index + 1 != w->eid.n)) {
+		return luaL_error(L, "Only the newest entity can be cloned");
+	}
+	if (n <= 0)
+		return 0;
+	// the components of the entity may be staged
+	ecs_flush_(w);
+	int first = entity_id_alloc_n(&w->eid, n);
+	if (first < 0) {
+		return luaL_error(L, "Too many entities");
+	}
+	int i, j;
+	for (i = 0; i < MAX_COMPONENT; i++) {
+		struct component_pool *c = &w->c[i];
+		int pos;
+		if (stable) {
+			if (c->cap == 0 || (pos = ecs_lookup_component_(c, make_index_(index), c->n - 1)) < 0)
+				continue;
+		} else if (c->flags & POOL_BITSET) {
+			if (!bitset_test(c, index))
+				continue;
+			pos = index;
+		} else {
+			if (c->n == 0 || index_(c->id[c->n - 1]) != index)
+				continue;
+			pos = c->n - 1;
+		}
+		int from = ecs_append_component_n_(w, i, first, n, NULL);
+		if (c->stride == STRIDE_LUA) {
+			get_lua_component(L, w, c, pos);
+			for (j = 0; j < n; j++) {
+				lua_pushvalue(L, -1);
+				new_lua_component(L, w, c, from + j);
+			}
+			lua_pop(L, 1);
+		} else if (c->stride > 0) {
+			fill_component(c, from, n, get_record(c, pos));
+			ecs_touch_(w, c, from, n);
+		}
+	}
+	return 0;
+}
+
 static int
 binary_search(entity_index_t *a, int from, int to, uint32_t v) {
 	while (from < to) {
@@ -370,23 +1100,86 @@ search_after(struct component_pool *pool, uint32_t eid, int from_index) {
 	return binary_search(a, from_index + 1, from_index + GUESS_RANGE + 1, eid);
 }
 
+// The staged components [n, n + pending) are not sorted, they are merged at the next query, see ecs_pool_flush_
+static inline int
+lookup_pending(struct component_pool *pool, uint32_t eid) {
+	int i;
+	int to = pool->n + pool->pending;
+	for (i = pool->n; i < to; i++) {
+		if (index_(pool->id[i]) == eid)
+			return i;
+	}
+	return -1;
+}
+
+// It doesn't merge the staged components, so a lookup never moves the rows
 int
 ecs_lookup_component_(struct component_pool *pool, entity_index_t eindex, int guess_index) {
+	if (pool->flags & POOL_BITSET) {
+		int idx = index_(eindex);
+		return bitset_test(pool, idx) ? idx : -1;
+	}
 	int n = pool->n;
-	if (n == 0)
-		return -1;
 	uint32_t eid = index_(eindex);
-	if (guess_index < 0 || guess_index >= pool->n)
-		return binary_search(pool->id, 0, pool->n, eid);
-	entity_index_t *a = pool->id;
-	entity_index_t lower_index = a[guess_index];
-	uint32_t lower = index_(lower_index);
-	if (eid <= lower) {
+	int r;
+	if (n == 0) {
+		r = -1;
+	} else if (pool->flags & POOL_SPARSE) {
+		r = eid < pool->sparse_cap ? pool->sparse[eid] : -1;
+	} else if (guess_index < 0 || guess_index >= pool->n) {
+		r = binary_search(pool->id, 0, pool->n, eid);
+	} else {
+		entity_index_t *a = pool->id;
+		uint32_t lower = index_(a[guess_index]);
 		if (eid == lower)
-			return guess_index;
-		return binary_search(a, 0, guess_index, eid);
+			r = guess_index;
+		else if (eid < lower)
+			r = binary_search(a, 0, guess_index, eid);
+		else
+			r = search_after(pool, eid, guess_index);
 	}
-	return search_after(pool, eid, guess_index);
+	if (r >= 0)
+		return tomb_test(pool, r) ? -1 : r;
+	if (pool->pending)
+		return lookup_pending(pool, eid);
+	return -1;
+}
+
+static inline int
+lower_bound(entity_index_t *a, int from, int to, int v) {
+	while (from < to) {
+		int mid = (from + to) / 2;
+		if ((int)index_(a[mid]) < v)
+			from = mid + 1;
+		else
+			to = mid;
+	}
+	return from;
+}
+
+// The first position whose entity >= eid, gallop from the position from.
+// It's O(log distance), so a join walks each pool once. The staged components are not in [0, n), flush them before the join.
+int
+ecs_seek_component_(struct component_pool *pool, int eid, int from) {
+	entity_index_t *a = pool->id;
+	int n = pool->n;
+	if (from <= 0 || from > n) {
+		from = 0;
+	} else if ((int)index_(a[from-1]) >= eid) {
+		// go back
+		return lower_bound(a, 0, from, eid);
+	}
+	int lo = from;
+	int hi = from;
+	int step = 1;
+	while (hi < n && (int)index_(a[hi]) < eid) {
+		lo = hi + 1;
+		hi += step;
+		step *= 2;
+	}
+	if (hi > n)
+		hi = n;
+	return lower_bound(a, lo, hi, eid);
 }
 
 static inline int
@@ -414,8 +1207,16 @@ static inline void
 move_item(struct component_pool *pool, int from, int to, int delta) {
 	pool->id[to] = DEC_ENTITY_INDEX(pool->id[from], delta);
 	if (from != to) {
-		int stride = pool->stride;
-		memcpy((char *)pool->buffer + to * stride, (char *)pool->buffer + from * stride, stride);
+		if (pool->flags & POOL_SOA) {
+			int i;
+			for (i = 0; i < pool->column_n; i++) {
+				memcpy(get_column(pool, i, to), get_column(pool, i, from), pool->column[i].size);
+			}
+		} else {
+			memcpy(get_ptr(pool, to), get_ptr(pool, from), pool->stride);
+		}
+		if (pool->flags & POOL_CHANGED)
+			pool->stamp[to] = pool->stamp[from];
 	}
 }
 
@@ -434,6 +1235,12 @@ remove_entityid(struct entity_world *w, struct component_pool *removed) {
 	if (n == 0)
 		return;
 	int i;
+	if (w->eid.stable) {
+		for (i=0;i<n;i++) {
+			entity_id_free(&w->eid, index_(removed->id[i]));
+		}
+		return;
+	}
 	uint32_t last = index_(removed->id[0]);
 	uint32_t offset = last;
 	uint64_t *eid = w->eid.id;
@@ -447,6 +1254,8 @@ remove_entityid(struct entity_world *w, struct component_pool *removed) {
 	uint32_t t = w->eid.n - last - 1;
 	memmove(eid+offset, eid+last+1, t * sizeof(uint64_t));
 	w->eid.n -= removed->n;
+	++w->eid.version;
+	entity_id_rebuild(&w->eid);
 }
 
 // return the biggset index less than v, or [index] = v:
@@ -473,24 +1282,87 @@ less_part(struct component_pool *c, entity_index_t vidx, int from) {
 	return begin;
 }
 
+// The entities after eindex are renumbered, update the map from pool index from
 static void
+sparse_rebuild_after(struct component_pool *pool, entity_index_t eindex, int from) {
+	if (!(pool->flags & POOL_SPARSE))
+		return;
+	uint32_t e = index_(eindex);
+	if (e < pool->sparse_cap)
+		memset(pool->sparse + e, 0xff, (pool->sparse_cap - e) * sizeof(int));
+	ecs_sparse_sync_(pool, from);
+}
+
+#define REMOVE_SKIP 0
+#define REMOVE_SHIFT 1
+#define REMOVE_MERGE 2
+
+// Clear the removed entities, and move the bits after them down
+static int
+bitset_remove(struct entity_world *w, struct component_pool *removed, struct component_pool *pool) {
+	entity_index_t *removed_id = removed->id;
+	int first = index_(removed_id[0]);
+	if (first >= pool->cap)
+		return REMOVE_SKIP;
+	int n = pool->n;
+	int i;
+	for (i = 0; i < removed->n; i++) {
+		ecs_bitset_clear_(pool, index_(removed_id[i]));
+	}
+	if (w->eid.stable)
+		return pool->n == n ? REMOVE_SKIP : REMOVE_MERGE;
+	int words = pool->cap >> 6;
+	int start = first >> 6;
+	int r = 0;
+	for (i = start; i < words; i++) {
+		uint64_t word = pool->bits[i];
+		if (i == start) {
+			uint64_t low = ((uint64_t)1 << (first & 63)) - 1;
+			pool->bits[i] = word & low;
+			word &= ~low;
+		} else {
+			pool->bits[i] = 0;
+		}
+		// the bit moves to a lower position, so the words before are done
+		while (word) {
+			int p = i * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+			while (r < removed->n && (int)index_(removed_id[r]) < p)
+				++r;
+			int to = p - r;
+			pool->bits[to >> 6] |= (uint64_t)1 << (to & 63);
+		}
+	}
+	++pool->version;
+	return pool->n == n ? REMOVE_SHIFT : REMOVE_MERGE;
+}
+
+// pool->id[0] and pool->id[n-1] are the min/max index of the pool
+// In stable mode, the indexes never shift (dec is 0)
+static int
 remove_all(lua_State *L, struct entity_world *w, struct component_pool *removed, int cid) {
 	struct component_pool *pool = &w->c[cid];
 	if (pool->n == 0)
-		return;
+		return REMOVE_SKIP;
+	if (pool->flags & POOL_BITSET)
+		return bitset_remove(w, removed, pool);
 	entity_index_t *removed_id = removed->id;
 	if (ENTITY_INDEX_CMP(removed_id[0], pool->id[pool->n-1]) > 0) {
 		// No action, because removed_id[0] is bigger than the biggest index in pool
-		return;
+		return REMOVE_SKIP;
 	}
+	int stable = w->eid.stable;
 	if (ENTITY_INDEX_CMP(pool->id[0], removed_id[removed->n-1]) > 0) {
+		if (stable)
+			return REMOVE_SKIP;
 		// No removed components, but the id in pool should -= removed->n
 		int n = removed->n;
 		int i;
 		for (i=0;i<pool->n;i++) {
 			pool->id[i] = DEC_ENTITY_INDEX(pool->id[i], n);
 		}
-		return;
+		sparse_rebuild_after(pool, removed_id[0], 0);
+		return REMOVE_SHIFT;
 	}
 	int removed_n = less_part(removed, pool->id[0], 0);
 	int i = 0;
@@ -499,6 +1371,7 @@ remove_all(lua_State *L, struct entity_world *w, struct component_pool *removed,
 		i = less_part(pool, removed_id[0], 0);
 	}
 	int index = i;
+	int from = i;
 	int delta = 0;
 	unsigned int * lua_index;
 	switch (pool->stride) {
@@ -514,7 +1387,7 @@ remove_all(lua_State *L, struct entity_world *w, struct component_pool *removed,
 				++i;
 			} else if (cmp < 0) {
 				// pool[i] < current removed
-				move_lua(pool, i, index, removed_n);
+				move_lua(pool, i, index, stable ? 0 : removed_n);
 				++index;
 				++i;
 			} else {
@@ -523,39 +1396,34 @@ remove_all(lua_State *L, struct entity_world *w, struct component_pool *removed,
 			}
 		}
 		for (;i<pool->n;i++) {
-			move_lua(pool, i, index, removed_n);
+			move_lua(pool, i, index, stable ? 0 : removed_n);
 			++index;
 		}
 		break;
-	case STRIDE_TAG: {
-		entity_index_t last = INVALID_ENTITY;
+	case STRIDE_TAG:
+		// the disabled tags are compacted before
 		while (i < pool->n && removed_n < removed->n) {
-			if (ENTITY_INDEX_CMP(pool->id[i], last) == 0) {
-				// remove duplicate
+			int cmp = ENTITY_INDEX_CMP(pool->id[i], removed_id[removed_n]);
+			if (cmp == 0) {
+				// pool[i] should be removed
+				++removed_n;
+				++delta;
+				++i;
+			} else if (cmp < 0) {
+				// pool[i] < current removed
+				move_tag(pool, i, index, stable ? 0 : removed_n);
+				++index;
 				++i;
 			} else {
-				int cmp = ENTITY_INDEX_CMP(pool->id[i], removed_id[removed_n]);
-				if (cmp == 0) {
-					// pool[i] should be removed
-					++delta;
-					++i;
-				} else if (cmp < 0) {
-					// pool[i] < current removed
-					last = pool->id[i];
-					move_tag(pool, i, index, removed_n);
-					++index;
-					++i;
-				} else {
-					// pool[i] > current removed, find next removed
-					removed_n = less_part(removed, pool->id[i], removed_n);
-				}
+				// pool[i] > current removed, find next removed
+				removed_n = less_part(removed, pool->id[i], removed_n);
 			}
 		}
 		for (;i<pool->n;i++) {
-			move_tag(pool, i, index, removed_n);
+			move_tag(pool, i, index, stable ? 0 : removed_n);
 			++index;
 		}
-		break; }
+		break;
 	default:
 		while (i < pool->n && removed_n < removed->n) {
 			int cmp = ENTITY_INDEX_CMP(pool->id[i], removed_id[removed_n]);
@@ -566,7 +1434,7 @@ remove_all(lua_State *L, struct entity_world *w, struct component_pool *removed,
 				++i;
 			} else if (cmp < 0) {
 				// pool[i] < current removed
-				move_item(pool, i, index, removed_n);
+				move_item(pool, i, index, stable ? 0 : removed_n);
 				++index;
 				++i;
 			} else {
@@ -575,12 +1443,18 @@ remove_all(lua_State *L, struct entity_world *w, struct component_pool *removed,
 			}
 		}
 		for (;i<pool->n;i++) {
-			move_item(pool, i, index, removed_n);
+			move_item(pool, i, index, stable ? 0 : removed_n);
 			++index;
 		}
 		break;
 	}
 	pool->n -= delta;
+	if (delta > 0)
+		++pool->version;
+	if (delta == 0 && stable)
+		return REMOVE_SKIP;
+	sparse_rebuild_after(pool, removed_id[0], from);
+	return REMOVE_MERGE;
 }
 
 static int
@@ -642,11 +1516,37 @@ lupdate(lua_State *L) {
 	int removed_id = luaL_optinteger(L, 2, ENTITY_REMOVED);
 	struct component_pool *removed = &w->c[removed_id];
 	int i;
+	ecs_flush_(w);
+	for (i = 0; i < MAX_COMPONENT / 64; i++) {
+		uint64_t mask = w->types[i];
+		int cid = i * 64;
+		for (; mask; mask >>= 1, ++cid) {
+			if (mask & 1)
+				ecs_tag_compact_(&w->c[cid]);
+		}
+	}
 	if (removed->n > 0) {
 		// mark removed
-		for (i = 0; i < MAX_COMPONENT; i++) {
-			if (i != removed_id)
-				remove_all(L, w, removed, i);
+		struct update_stat *stat = &w->stat;
+		++stat->update;
+		for (i = 0; i < MAX_COMPONENT / 64; i++) {
+			uint64_t mask = w->types[i];
+			int cid = i * 64;
+			for (; mask; mask >>= 1, ++cid) {
+				if (!(mask & 1) || cid == removed_id)
+					continue;
+				switch (remove_all(L, w, removed, cid)) {
+				case REMOVE_MERGE:
+					++stat->merge;
+					break;
+				case REMOVE_SHIFT:
+					++stat->shift;
+					break;
+				default:
+					++stat->skip;
+					break;
+				}
+			}
 		}
 		remove_entityid(w, removed);
 		removed->n = 0;
@@ -655,6 +1555,26 @@ lupdate(lua_State *L) {
 	return 0;
 }
 
+static int
+lupdate_stat(lua_State *L) {
+	struct entity_world *w = getW(L);
+	struct update_stat *stat = &w->stat;
+	int reset = lua_toboolean(L, 2);
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, stat->update);
+	lua_setfield(L, -2, "update");
+	lua_pushinteger(L, stat->merge);
+	lua_setfield(L, -2, "merge");
+	lua_pushinteger(L, stat->shift);
+	lua_setfield(L, -2, "shift");
+	lua_pushinteger(L, stat->skip);
+	lua_setfield(L, -2, "skip");
+	if (reset) {
+		memset(stat, 0, sizeof(*stat));
+	}
+	return 1;
+}
+
 static int
 lclear_type(lua_State *L) {
 	struct entity_world *w = getW(L);
@@ -671,7 +1591,7 @@ lcontext(lua_State *L) {
 	lua_setiuservalue(L, -2, 1);
 	ctx->world = w;
 	static struct ecs_capi c_api = {
-		entity_fetch_,
+		entity_fetch_c_,
 		entity_clear_type_,
 		entity_component_,
 		entity_component_index_,
@@ -692,6 +1612,18 @@ lcontext(lua_State *L) {
 		ecs_cache_fetch,
 		ecs_cache_fetch_index,
 		ecs_cache_sync,
+		entity_column_,
+		entity_new_batch_,
+		entity_join_,
+		entity_changed_,
+		entity_span_,
+		entity_component_index_r_,
+		entity_index_r_,
+		entity_split_,
+		entity_tag_op_,
+		entity_hierarchy_,
+		entity_propagate_all_,
+		entity_fetch_r_,
 	};
 	ctx->api = &c_api;
 	return 1;
@@ -702,13 +1634,26 @@ lnew_world(lua_State *L) {
 	size_t sz = sizeof(struct entity_world);
 	struct entity_world *w = (struct entity_world *)lua_newuserdatauv(L, sz, 1);
 	memset(w, 0, sz);
+	if (lua_isnoneornil(L, 3)) {
+		w->alloc.f = lua_getallocf(L, &w->alloc.ud);
+	} else {
+		luaL_checktype(L, 3, LUA_TLIGHTUSERDATA);
+		struct ecs_alloc_hook *hook = (struct ecs_alloc_hook *)lua_touserdata(L, 3);
+		w->alloc.f = hook->alloc;
+		w->alloc.ud = hook->ud;
+	}
+	w->eid.alloc = &w->alloc;
+	w->group.alloc = &w->alloc;
+	w->hierarchy.alloc = &w->alloc;
+	w->clock = 1;
 	w->lua.L = lua_newthread(L);
 	lua_newtable(w->lua.L);	// table for all lua components
 	lua_setiuservalue(L, -2, 1);
 	// removed set
 	int world_index = lua_gettop(L);
-	entity_new_type(L, world_index, ENTITY_REMOVED, 0, 0);
+	entity_new_type(L, world_index, ENTITY_REMOVED, 0, 0, 0);
 	luaL_checktype(L, 1, LUA_TTABLE);
+	w->eid.stable = lua_toboolean(L, 2);
 	lua_pushvalue(L, 1);
 	lua_setmetatable(L, -2);
 	return 1;
@@ -719,18 +1664,41 @@ ldeinit_world(lua_State *L) {
 	struct entity_world *w = lua_touserdata(L, 1);
 	entity_group_deinit_(&w->group);
 	entity_id_deinit(&w->eid);
+	entity_hierarchy_deinit_(&w->hierarchy);
 	int i;
 	for (i=0;i<MAX_COMPONENT;i++) {
 		struct component_pool *c = &w->c[i];
-		if (c->stride != STRIDE_TAG) {
-			free(c->buffer);
+		if (c->flags & POOL_PAGED) {
+			paged_free(c);
+		} else if (c->stride != STRIDE_TAG) {
+			pool_free(c, c->buffer);
 			c->buffer = NULL;
 			c->id = NULL;
 		} else {
-			free(c->id);
+			pool_free(c, c->id);
 			c->id = NULL;
 		}
-	}
+		ecs_free_(c->alloc, c->sparse);
+		c->sparse = NULL;
+		c->sparse_cap = 0;
+		ecs_free_(c->alloc, c->bits);
+		c->bits = NULL;
+		ecs_free_(c->alloc, c->tomb);
+		c->tomb = NULL;
+		c->tomb_cap = 0;
+		c->tomb_n = 0;
+		ecs_free_(c->alloc, c->column);
+		c->column = NULL;
+		c->record = NULL;
+	}
+	ecs_arena_free_(&w->alloc);
+	return 0;
+}
+
+static int
+lclear_transient(lua_State *L) {
+	struct entity_world *w = getW(L);
+	clear_transient(w);
 	return 0;
 }
 
@@ -739,8 +1707,14 @@ lreset_world(lua_State *L) {
 	struct entity_world *w = lua_touserdata(L, 1);
 	entity_group_deinit_(&w->group);
 	entity_id_deinit(&w->eid);
+	int stable = w->eid.stable;
+	uint32_t version = w->eid.version;
 	memset(&w->group, 0, sizeof(w->group));
 	memset(&w->eid, 0, sizeof(w->eid));
+	w->eid.stable = stable;
+	w->eid.version = version + 1;
+	w->eid.alloc = &w->alloc;
+	w->group.alloc = &w->alloc;
 	lua_settop(w->lua.L, 0);
 	lua_newtable(w->lua.L);
 	w->lua.freelist = 0;
@@ -749,7 +1723,15 @@ lreset_world(lua_State *L) {
 	for (i=0;i<MAX_COMPONENT;i++) {
 		struct component_pool *c = &w->c[i];
 		c->n = 0;
-	}
+		c->pending = 0;
+		++c->version;
+		tomb_reset(c);
+		ecs_sparse_rebuild_(c);
+		if (c->flags & POOL_BITSET)
+			memset(c->bits, 0, (c->cap >> 6) * sizeof(uint64_t));
+	}
+	w->pending = 0;
+	clear_transient(w);
 	return 0;
 }
 
@@ -985,6 +1967,8 @@ get_len(lua_State *L, int index) {
 #define COMPONENT_EXIST 0x10
 #define COMPONENT_ABSENT 0x20
 #define COMPONENT_FILTER (COMPONENT_EXIST | COMPONENT_ABSENT)
+#define COMPONENT_DRIVER 0x40	// required key, the iteration can be driven from its pool
+#define COMPONENT_CHANGED 0x80	// written after the last select
 
 static inline int
 is_temporary(int attrib) {
@@ -993,6 +1977,33 @@ is_temporary(int attrib) {
 	return (attrib & COMPONENT_IN) == 0 && (attrib & COMPONENT_OUT) == 0;
 }
 
+// Like entity_component_index_, but seek from the cursor of the key
+static inline int
+cursor_index(struct entity_world *w, struct group_key *k, struct ecs_token t) {
+	if (k->id < 0)
+		return t.id;
+	struct component_pool *c = &w->c[k->id];
+	if (c->flags & POOL_BITSET)
+		return bitset_test(c, t.id) ? t.id : -1;
+	if (c->flags & POOL_SPARSE)
+		return ecs_lookup_component_(c, make_index_(t.id), -1);
+	int pos = ecs_seek_component_(c, t.id, k->cursor);
+	k->cursor = pos;
+	if (pos < c->n && (int)index_(c->id[pos]) == t.id)
+		return tomb_test(c, pos) ? -1 : pos;
+	if (c->pending)
+		return lookup_pending(c, t.id);
+	return -1;
+}
+
+static inline void
+reset_cursor(struct group_iter *iter) {
+	int i;
+	for (i = 0; i < iter->nkey; i++) {
+		iter->k[i].cursor = 0;
+	}
+}
+
 static int
 get_write_component(lua_State *L, int lua_index, const char *name, struct group_field *f, struct component_pool *c) {
 	switch (lua_getfield(L, lua_index, name)) {
@@ -1100,6 +2111,34 @@ remove_tag(lua_State *L, int lua_index, const char *name) {
 	return r;
 }
 
+// Write back the component of :update / :out, the version of :changed is stamped only if the bytes differ
+static void
+write_back_component(lua_State *L, struct entity_world *w, struct component_pool *c, int index, int field_n, struct group_field *f) {
+	void *buffer = get_record(c, index);
+	if (!(c->flags & POOL_CHANGED)) {
+		ecs_write_component_object_(L, field_n, f, buffer);
+		set_record(c, index, buffer);
+		return;
+	}
+	uint64_t stack_tmp[32];
+	char *tmp = (char *)stack_tmp;
+	int tmp_index = 0;
+	if (c->stride > (int)sizeof(stack_tmp)) {
+		// keep the lua object on the top
+		tmp = (char *)lua_newuserdatauv(L, c->stride, 0);
+		lua_insert(L, -2);
+		tmp_index = lua_gettop(L) - 1;
+	}
+	memcpy(tmp, buffer, c->stride);
+	ecs_write_component_object_(L, field_n, f, tmp);
+	if (memcmp(tmp, buffer, c->stride) != 0) {
+		set_record(c, index, tmp);
+		ecs_touch_(w, c, index, 1);
+	}
+	if (tmp_index)
+		lua_remove(L, tmp_index);
+}
+
 static void
 update_iter(lua_State *L, int lua_index, struct group_iter *iter, int idx, int mainkey, int skip) {
 	struct group_field *f = iter->f;
@@ -1127,7 +2166,7 @@ update_iter(lua_State *L, int lua_index, struct group_iter *iter, int idx, int m
 							entity_enable_tag_(iter->world, token, k->id);
 						} else {
 							if (k->id != mainkey) {
-								int tag_index = entity_component_index_(iter->world, token, k->id);
+								int tag_index = cursor_index(iter->world, k, token);
 								if (tag_index >= 0)
 									entity_disable_tag_(iter->world, k->id, tag_index);
 							}
@@ -1145,31 +2184,29 @@ update_iter(lua_State *L, int lua_index, struct group_iter *iter, int idx, int m
 				}
 			} else if ((k->attrib & COMPONENT_OUT)
 				&& get_write_component(L, lua_index, k->name, f, c)) {
-				int index = entity_component_index_(iter->world, token, k->id);
+				int index = cursor_index(iter->world, k, token);
 				if (index < 0) {
 					luaL_error(L, "Can't find component %s of %s", k->name, iter->k[0].name);
 				}
 				if (c->stride == STRIDE_LUA) {
 					set_lua_component(L, iter->world, c, index);
 				} else {
-					void *buffer = get_ptr(c, index);
-					ecs_write_component_object_(L, k->field_n, f, buffer);
+					write_back_component(L, iter->world, c, index, k->field_n, f);
 				}
 			} else if (is_temporary(k->attrib)
 				&& get_write_component(L, lua_index, k->name, f, c)) {
+				entity_index_t eid = make_index_(token.id);
+				int index = ecs_add_component_id_(iter->world, k->id, eid);
+				if (index < 0) {
+					luaL_error(L, "component %d exist", k->id);
+				}
 				if (c->stride == STRIDE_LUA) {
-					entity_index_t eid = make_index_(token.id);
-					int index = ecs_add_component_id_(iter->world, k->id, eid);
-					if (index < 0) {
-						luaL_error(L, "component %d exist", k->id);
-					}
 					new_lua_component(L, iter->world, c, index);
 				} else {
-					void *buffer = entity_component_add_(iter->world, token, k->id, NULL);
-					if (buffer == NULL) {
-						luaL_error(L, "component %d exist", k->id);
-					}
+					void *buffer = get_record(c, index);
 					ecs_write_component_object_(L, k->field_n, f, buffer);
+					set_record(c, index, buffer);
+					ecs_touch_(iter->world, c, index, 1);
 				}
 			}
 		}
@@ -1201,8 +2238,7 @@ update_last_index(lua_State *L, int lua_index, struct group_iter *iter, int idx)
 			if (c->stride == STRIDE_LUA) {
 				set_lua_component(L, iter->world, c, idx);
 			} else {
-				void *buffer = get_ptr(c, idx);
-				ecs_write_component_object_(L, iter->k[0].field_n, iter->f, buffer);
+				write_back_component(L, iter->world, c, idx, iter->k[0].field_n, iter->f);
 			}
 		}
 	}
@@ -1230,9 +2266,9 @@ check_update(lua_State *L, int lua_index, struct group_iter *iter, int idx) {
 			if (c->stride > 0 && !(k->attrib & COMPONENT_OUT) && (k->attrib & COMPONENT_IN) && k->id != ENTITYID_TAG) {
 				// readonly C component, check it
 				if (get_write_component(L, lua_index, k->name, f, c)) {
-					void *buffer = entity_component_(iter->world, token, k->id);
-					if (buffer) {
-						write_component_object_check(L, k->field_n, f, buffer, k->name);
+					int index = entity_component_index_(iter->world, token, k->id);
+					if (index >= 0) {
+						write_component_object_check(L, k->field_n, f, get_record(c, index), k->name);
 					}
 				}
 			}
@@ -1265,31 +2301,76 @@ read_component_in_field(lua_State *L, int lua_index, const char *name, int n, st
 	lua_pop(L, 1);
 }
 
-// -1 : end ; 0 : next ; 1 : succ
+// 0 : next ; 1 : succ
+#define PRED_COMPARE(op, a, b) \
+	switch (op) { \
+	case PRED_EQ: return a == b; \
+	case PRED_NE: return a != b; \
+	case PRED_LT: return a < b; \
+	case PRED_LE: return a <= b; \
+	case PRED_GT: return a > b; \
+	default: return a >= b; \
+	}
+
+static inline int
+pred_number(int op, double a, double b) {
+	PRED_COMPARE(op, a, b)
+}
+
+static inline int
+pred_integer(int op, int64_t a, int64_t b) {
+	PRED_COMPARE(op, a, b)
+}
+
 static int
-query_index(struct group_iter *iter, int skip, int mainkey, int *idx, int index[MAX_COMPONENT], struct ecs_token *token) {
-	struct ecs_token tmp;
-	if (token) {
-		*idx = entity_next_tag_(iter->world, mainkey, *idx, token);
-		if (*idx < 0)
-			return -1;
-	} else {
-		++*idx;
-		token = &tmp;
-		if (entity_fetch_(iter->world, mainkey, *idx, token) == NULL)
-			return -1;
+match_pred(struct group_iter *iter, struct group_pred *p, int index[MAX_COMPONENT]) {
+	struct component_pool *c = &iter->world->c[iter->k[p->key].id];
+	int idx = index[p->key];
+	const char *ptr;
+	if (c->flags & POOL_SOA)
+		ptr = (const char *)get_column(c, p->offset, idx);
+	else
+		ptr = (const char *)get_ptr(c, idx) + p->offset;
+	int64_t v;
+	switch (p->type) {
+	case TYPE_FLOAT:
+		return pred_number(p->op, *(const float *)ptr, p->n);
+	case TYPE_DOUBLE:
+		return pred_number(p->op, *(const double *)ptr, p->n);
+	case TYPE_INT:
+		v = *(const int *)ptr;
+		break;
+	case TYPE_INT64:
+		v = *(const int64_t *)ptr;
+		break;
+	case TYPE_DWORD:
+		v = *(const uint32_t *)ptr;
+		break;
+	case TYPE_WORD:
+		v = *(const uint16_t *)ptr;
+		break;
+	default:	// TYPE_BYTE, TYPE_BOOL
+		v = *(const uint8_t *)ptr;
+		break;
 	}
+	if (p->isint)
+		return pred_integer(p->op, v, p->i);
+	return pred_number(p->op, (double)v, p->n);
+}
+
+static int
+match_keys(struct group_iter *iter, int skip, struct ecs_token token, int index[MAX_COMPONENT]) {
 	int j;
 	for (j = skip; j < iter->nkey; j++) {
 		struct group_key *k = &iter->k[j];
 		if (k->attrib & COMPONENT_ABSENT) {
-			if (entity_component_index_(iter->world, *token, k->id) >= 0) {
+			if (cursor_index(iter->world, k, token) >= 0) {
 				// exist. try next
 				return 0;
 			}
 			index[j] = -1;
 		} else if (!is_temporary(k->attrib)) {
-			index[j] = entity_component_index_(iter->world, *token, k->id);
+			index[j] = cursor_index(iter->world, k, token);
 			if (index[j] < 0) {
 				if (!(k->attrib & COMPONENT_OPTIONAL)) {
 					// required. try next
@@ -1300,9 +2381,87 @@ query_index(struct group_iter *iter, int skip, int mainkey, int *idx, int index[
 			index[j] = -1;
 		}
 	}
+	if (iter->changed) {
+		for (j = 0; j < iter->nkey; j++) {
+			struct group_key *k = &iter->k[j];
+			if ((k->attrib & COMPONENT_CHANGED) && *get_stamp(&iter->world->c[k->id], index[j]) <= iter->since)
+				return 0;
+		}
+	}
+	for (j = 0; j < iter->pred_n; j++) {
+		if (!match_pred(iter, &iter->p[j], index))
+			return 0;
+	}
 	return 1;
 }
 
+// -1 : end ; 0 : next ; 1 : succ
+static int
+query_index(struct group_iter *iter, int skip, int mainkey, int *idx, int index[MAX_COMPONENT], struct ecs_token *token) {
+	struct ecs_token tmp;
+	if (token) {
+		*idx = entity_next_tag_(iter->world, mainkey, *idx, token);
+		if (*idx < 0)
+			return -1;
+	} else {
+		++*idx;
+		token = &tmp;
+		if (entity_fetch_(iter->world, mainkey, *idx, token) == NULL) {
+			if (mainkey < 0 && *idx < iter->world->eid.n) {
+				// free slot
+				return 0;
+			}
+			return -1;
+		}
+	}
+	index[0] = *idx;
+	return match_keys(iter, skip, *token, index);
+}
+
+// Pick the smallest pool of the required keys, 0 means the mainkey
+static int
+choose_driver(struct group_iter *iter) {
+	struct entity_world *w = iter->world;
+	int mainkey = iter->k[0].id;
+	int n = (mainkey < 0) ? w->eid.n : w->c[mainkey].n;
+	int driver = 0;
+	int i;
+	for (i = 1; i < iter->nkey; i++) {
+		struct group_key *k = &iter->k[i];
+		if ((k->attrib & COMPONENT_DRIVER) && !(w->c[k->id].flags & POOL_BITSET)) {
+			int cn = w->c[k->id].n;
+			// each row of the driver looks up the mainkey, so it should be much smaller
+			if (cn * 2 < n) {
+				n = cn;
+				driver = i;
+			}
+		}
+	}
+	return driver;
+}
+
+// Same as query_index, but walk the pool of k[driver], and *idx is the position of the mainkey.
+// token->id is the last entity (-1 for the first).
+static int
+query_driver(struct group_iter *iter, int driver, int *pos, int *idx, int index[MAX_COMPONENT], struct ecs_token *token) {
+	struct group_key *k = &iter->k[driver];
+	struct component_pool *c = &iter->world->c[k->id];
+	int p = *pos + 1;
+	// skip the disabled tags, and the rows moved by the insertions
+	while (p < c->n && ((int)index_(c->id[p]) <= token->id || tomb_test(c, p)))
+		++p;
+	*pos = p;
+	k->cursor = p;
+	if (p >= c->n)
+		return -1;
+	token->id = index_(c->id[p]);
+	*idx = cursor_index(iter->world, &iter->k[0], *token);
+	if (*idx < 0)
+		return 0;
+	index[0] = *idx;
+	return match_keys(iter, 1, *token, index);
+}
+
 static void
 read_iter(lua_State *L, int obj_index, struct group_iter *iter, int index[MAX_COMPONENT]) {
 	struct group_field *f = iter->f;
@@ -1322,7 +2481,7 @@ read_iter(lua_State *L, int obj_index, struct group_iter *iter, int index[MAX_CO
 				lua_setfield(L, obj_index, k->name);
 			} else if (k->attrib & COMPONENT_IN) {
 				if (index[i] >= 0) {
-					void *ptr = get_ptr(c, index[i]);
+					void *ptr = get_record(c, index[i]);
 					read_component_in_field(L, obj_index, k->name, k->field_n, f, ptr);
 				} else {
 					lua_pushnil(L);
@@ -1357,12 +2516,18 @@ lread(lua_State *L) {
 }
 
 static inline struct group_iter *
-submit_index(lua_State *L, int iter_index, int i, int check) {
+submit_iter(lua_State *L, int iter_index) {
 	if (lua_rawgeti(L, iter_index, 3) != LUA_TUSERDATA) {
 		luaL_error(L, "Invalid iterator");
 	}
 	struct group_iter * iter = lua_touserdata(L, -1);
 	lua_pop(L, 1);
+	return iter;
+}
+
+static inline struct group_iter *
+submit_index(lua_State *L, int iter_index, int i, int check) {
+	struct group_iter * iter = submit_iter(L, iter_index);
 	if (check) {
 		check_update(L, iter_index, iter, i);
 	}
@@ -1387,64 +2552,215 @@ lsubmit(lua_State *L) {
 	return 0;
 }
 
+static inline unsigned int
+key_version(struct entity_world *w, struct group_key *k) {
+	if (k->id < 0)
+		return w->eid.version;
+	return w->c[k->id].version;
+}
+
+// The temporary keys (new) don't change the matches
+static int
+cache_versions_unchanged(struct group_iter *iter) {
+	int i;
+	for (i = 0; i < iter->nkey; i++) {
+		struct group_key *k = &iter->k[i];
+		if (!is_temporary(k->attrib) && k->version != key_version(iter->world, k))
+			return 0;
+	}
+	return 1;
+}
+
+// :changed and the predicates depend on the values, they are never cached
 static inline int
-leach_group_(lua_State *L, int check) {
-	struct group_iter *iter = lua_touserdata(L, 1);
-	if (lua_rawgeti(L, 2, 1) != LUA_TNUMBER) {
-		return luaL_error(L, "Invalid group iterator");
+cache_unchanged(struct group_iter *iter) {
+	return !iter->changed && iter->pred_n == 0 && cache_versions_unchanged(iter);
+}
+
+static inline int
+cache_valid(struct group_iter *iter) {
+	return iter->cache_n >= 0 && cache_unchanged(iter);
+}
+
+// returns the serial of the iteration which records the matches
+static int
+cache_begin(struct group_iter *iter) {
+	int i;
+	for (i = 0; i < iter->nkey; i++) {
+		struct group_key *k = &iter->k[i];
+		k->version = key_version(iter->world, k);
 	}
-	int i = lua_tointeger(L, -1);
-	if (i < 0)
-		return luaL_error(L, "Invalid iterator index %d", i);
-	lua_pop(L, 1);
+	iter->cache_n = -1;
+	iter->record_n = 0;
+	iter->columns_n = -1;
+	iter->count_n = -1;
+	return ++iter->serial;
+}
 
-	if (lua_getiuservalue(L, 1, 1) != LUA_TUSERDATA) {
-		return luaL_error(L, "Missing world object for iterator");
+static inline int *
+cache_buffer(lua_State *L, int iter_index, int *cap) {
+	int *buf = NULL;
+	*cap = 0;
+	if (lua_getiuservalue(L, iter_index, 2) == LUA_TUSERDATA) {
+		buf = (int *)lua_touserdata(L, -1);
+		*cap = (int)(lua_rawlen(L, -1) / sizeof(int));
 	}
+	lua_pop(L, 1);
+	return buf;
+}
+
+static void
+cache_record(lua_State *L, int iter_index, struct group_iter *iter, int idx) {
+	int cap;
+	int *buf = cache_buffer(L, iter_index, &cap);
+	if (iter->record_n >= cap) {
+		cap = cap * 2;
+		if (cap < 64)
+			cap = 64;
+		int *newbuf = (int *)lua_newuserdatauv(L, cap * sizeof(int), 0);
+		if (iter->record_n > 0)
+			memcpy(newbuf, buf, iter->record_n * sizeof(int));
+		lua_setiuservalue(L, iter_index, 2);
+		buf = newbuf;
+	}
+	buf[iter->record_n++] = idx;
+}
+
+static inline void
+cache_end(struct group_iter *iter) {
+	if (cache_unchanged(iter))
+		iter->cache_n = iter->record_n;
+}
+
+// the next cached match, returns 0 if the cache is not valid any more
+static int
+query_cache(lua_State *L, struct group_iter *iter, int *pos, int *idx, int index[MAX_COMPONENT], struct ecs_token *token) {
+	if (!cache_valid(iter))
+		return 0;
+	if (*pos >= iter->cache_n)
+		return -1;
+	int cap;
+	int *buf = cache_buffer(L, 1, &cap);
+	*idx = buf[(*pos)++];
+	index[0] = *idx;
+	if (entity_fetch_(iter->world, iter->k[0].id, *idx, token) == NULL || !match_keys(iter, 1, *token, index))
+		return luaL_error(L, "Invalid query cache");
+	return 1;
+}
 
+// The iterator (1) and its table (2) are at the bottom of the stack, i is the last iterator index.
+// Returns 0 at the end.
+static int
+next_group(lua_State *L, struct group_iter *iter, int i) {
 	int index[MAX_COMPONENT];
 	int mainkey = iter->k[0].id;
-
-	if (i > 0) {
-		if (submit_index(L, 2, i-1, check) != iter) {
-			// iterator extended, restore it
-			lua_pushvalue(L, 1);
-			lua_rawseti(L, 2, 3);
-		}
-	}
+	int driver = 0;
+	if (lua_rawgeti(L, 2, 4) == LUA_TNUMBER) {
+		driver = lua_tointeger(L, -1);
+		if (driver < 0 || driver >= iter->nkey)
+			return luaL_error(L, "Invalid driver %d", driver);
+	}
+	int record = (lua_rawgeti(L, 2, 5) == LUA_TNUMBER && lua_tointeger(L, -1) == iter->serial);
+	lua_pop(L, 2);
 	struct ecs_token tmp;
 	struct ecs_token *token = NULL;
+	int idx = i - 1;
 	int istag = mainkey_istag(iter);
-	if (istag) {
+	if (lua_rawgeti(L, 2, 6) == LUA_TNUMBER) {
+		// replay the cached matches
+		int pos = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		int ret = query_cache(L, iter, &pos, &idx, index, &tmp);
+		if (ret < 0)
+			return 0;
+		if (ret > 0) {
+			lua_pushinteger(L, pos);
+			lua_rawseti(L, 2, 6);
+			token = &tmp;
+			goto found;
+		}
+		// structural changes in the loop, continue without the cache
+		lua_pushnil(L);
+		lua_rawseti(L, 2, 6);
+	} else {
+		lua_pop(L, 1);
+	}
+	if (driver > 0 || istag) {
 		token = &tmp;
+		tmp.id = -1;
 		if (i > 0) {
 			if (lua_rawgeti(L, 2, 0) != LUA_TNUMBER) {
 				return luaL_error(L, "Invalid group iterator, missing token");
 			}
-			token->id = lua_tointeger(L, -1);
+			tmp.id = lua_tointeger(L, -1);
 			lua_pop(L, 1);
 		}
 	}
-	int idx = i - 1;
-	for (;;) {
-		int ret = query_index(iter, 1, mainkey, &idx, index, token);
-		if (ret < 0)
-			return 0;
-		if (ret > 0)
-			break;
+	if (driver > 0) {
+		// the driver pool may be changed by the last submit, so search it again
+		struct group_key *k = &iter->k[driver];
+		int pos = ecs_seek_component_(&iter->world->c[k->id], tmp.id + 1, k->cursor) - 1;
+		for (;;) {
+			int ret = query_driver(iter, driver, &pos, &idx, index, token);
+			if (ret < 0)
+				goto end;
+			if (ret > 0)
+				break;
+		}
+	} else {
+		for (;;) {
+			int ret = query_index(iter, 1, mainkey, &idx, index, istag ? token : NULL);
+			if (ret < 0)
+				goto end;
+			if (ret > 0)
+				break;
+		}
 	}
+	if (record)
+		cache_record(L, 1, iter, idx);
+found:
 	index[0] = idx;
 
 	lua_pushinteger(L, idx+1);
 	lua_rawseti(L, 2, 1);	// iterator
 
-	if (istag) {
+	if (token) {
 		lua_pushinteger(L, token->id);
 		lua_rawseti(L, 2, 0);	// token
 	}
 
 	read_iter(L, 2, iter, index);
+	return 1;
+end:
+	if (record)
+		cache_end(iter);
+	return 0;
+}
+
+static inline int
+leach_group_(lua_State *L, int check) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	if (lua_rawgeti(L, 2, 1) != LUA_TNUMBER) {
+		return luaL_error(L, "Invalid group iterator");
+	}
+	int i = lua_tointeger(L, -1);
+	if (i < 0)
+		return luaL_error(L, "Invalid iterator index %d", i);
+	lua_pop(L, 1);
+
+	if (lua_getiuservalue(L, 1, 1) != LUA_TUSERDATA) {
+		return luaL_error(L, "Missing world object for iterator");
+	}
 
+	if (i > 0) {
+		if (submit_index(L, 2, i-1, check) != iter) {
+			// iterator extended, restore it
+			lua_pushvalue(L, 1);
+			lua_rawseti(L, 2, 3);
+		}
+	}
+	if (!next_group(L, iter, i))
+		return 0;
 	lua_settop(L, 2);
 	return 1;
 }
@@ -1459,15 +2775,141 @@ leach_group_check(lua_State *L) {
 	return leach_group_(L, 1);
 }
 
+// Collect all the matches into the cache buffer, returns the number of them
 static int
-lcount(lua_State *L) {
-	struct group_iter *iter = lua_touserdata(L, 1);
+collect_matches(lua_State *L, int iter_index, struct group_iter *iter) {
 	int index[MAX_COMPONENT];
 	int mainkey = iter->k[0].id;
+	if (cache_valid(iter)) {
+		++iter->hit;
+		return iter->cache_n;
+	}
+	++iter->miss;
+	cache_begin(iter);
+	struct ecs_token token;
+	int idx = -1;
+	reset_cursor(iter);
+	int driver = choose_driver(iter);
+	if (driver > 0) {
+		int pos = -1;
+		token.id = -1;
+		for (;;) {
+			int ret = query_driver(iter, driver, &pos, &idx, index, &token);
+			if (ret < 0)
+				break;
+			if (ret > 0)
+				cache_record(L, iter_index, iter, idx);
+		}
+	} else {
+		for (;;) {
+			int ret = query_index(iter, 1, mainkey, &idx, index, &token);
+			if (ret < 0)
+				break;
+			if (ret > 0)
+				cache_record(L, iter_index, iter, idx);
+		}
+	}
+	cache_end(iter);
+	return iter->record_n;
+}
+
+// Count by the leapfrog join of the required pools, and check the absent ones.
+// Returns -1 if the pattern can't be counted in this way (eid, :changed or predicates)
+static int
+all_bitset(struct entity_world *w, int n, const int cid[]) {
+	int i;
+	for (i = 0; i < n; i++) {
+		if (!(w->c[cid[i]].flags & POOL_BITSET))
+			return 0;
+	}
+	return 1;
+}
+
+// Count word by word, when all the keys are bitsets
+static int
+count_bitset(struct entity_world *w, int n, const int cid[], int an, const int absent[]) {
+	int words = w->c[cid[0]].cap >> 6;
+	int i, j;
+	for (i = 1; i < n; i++) {
+		int cw = w->c[cid[i]].cap >> 6;
+		if (cw < words)
+			words = cw;
+	}
+	int count = 0;
+	for (i = 0; i < words; i++) {
+		uint64_t v = w->c[cid[0]].bits[i];
+		for (j = 1; j < n; j++) {
+			v &= w->c[cid[j]].bits[i];
+		}
+		for (j = 0; j < an; j++) {
+			struct component_pool *c = &w->c[absent[j]];
+			if (i < (c->cap >> 6))
+				v &= ~c->bits[i];
+		}
+		count += __builtin_popcountll(v);
+	}
+	return count;
+}
+
+static int
+count_join(struct group_iter *iter) {
+	struct entity_world *w = iter->world;
+	int cid[MAX_COMPONENT];
+	int index[MAX_COMPONENT];
+	int absent[MAX_COMPONENT];
+	int cursor[MAX_COMPONENT];
+	int n = 0;
+	int an = 0;
+	int i;
+	if (iter->changed || iter->pred_n)
+		return -1;
+	for (i = 0; i < iter->nkey; i++) {
+		struct group_key *k = &iter->k[i];
+		if (is_temporary(k->attrib) || (k->attrib & COMPONENT_OPTIONAL))
+			continue;
+		if (k->id < 0)
+			return -1;
+		if (k->attrib & COMPONENT_ABSENT) {
+			absent[an] = k->id;
+			cursor[an] = 0;
+			++an;
+		} else {
+			cid[n] = k->id;
+			index[n] = 0;
+			++n;
+		}
+	}
+	if (n > 0 && all_bitset(w, n, cid) && all_bitset(w, an, absent))
+		return count_bitset(w, n, cid, an, absent);
+	struct ecs_token t = { -1 };
 	int count = 0;
-	if (iter->nkey == 1) {
+	while (entity_join_(w, n, cid, index, &t)) {
+		for (i = 0; i < an; i++) {
+			struct component_pool *c = &w->c[absent[i]];
+			if (c->flags & POOL_BITSET) {
+				if (bitset_test(c, t.id))
+					break;
+				continue;
+			}
+			int pos = ecs_seek_component_(c, t.id, cursor[i]);
+			cursor[i] = pos;
+			if (pos < c->n && (int)index_(c->id[pos]) == t.id && !tomb_test(c, pos))
+				break;
+		}
+		if (i == an)
+			++count;
+	}
+	return count;
+}
+
+static int
+lcount(lua_State *L) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	int mainkey = iter->k[0].id;
+	ecs_flush_(iter->world);
+	if (iter->nkey == 1 && !iter->changed && iter->pred_n == 0) {
 		if (mainkey < 0) {
-			lua_pushinteger(L, iter->world->eid.n);
+			lua_pushinteger(L, iter->world->eid.n - iter->world->eid.free_n);
 			return 1;
 		}
 		struct component_pool *c = &iter->world->c[mainkey];
@@ -1476,16 +2918,31 @@ lcount(lua_State *L) {
 			return 1;
 		}
 	}
-	struct ecs_token token;
-	int idx = -1;
-	for (;;) {
-		int ret = query_index(iter, 1, mainkey, &idx, index, &token);
-		if (ret < 0)
-			break;
-		if (ret > 0)
-			++count;
+	if (cache_valid(iter)) {
+		++iter->hit;
+		lua_pushinteger(L, iter->cache_n);
+		return 1;
+	}
+	if (iter->count_n >= 0 && cache_unchanged(iter)) {
+		++iter->hit;
+		lua_pushinteger(L, iter->count_n);
+		return 1;
+	}
+	int n = count_join(iter);
+	if (n >= 0) {
+		// keep the count only, the matches are not recorded
+		++iter->miss;
+		cache_begin(iter);
+		iter->count_n = n;
+		lua_pushinteger(L, n);
+		return 1;
 	}
-	lua_pushinteger(L, count);
+	// count doesn't advance the clock of :changed
+	uint32_t since = iter->since;
+	iter->since = iter->clock;
+	n = collect_matches(L, 1, iter);
+	iter->since = since;
+	lua_pushinteger(L, n);
 	return 1;
 }
 
@@ -1525,11 +2982,9 @@ create_key_cache(lua_State *L, struct group_key *k, struct group_field *f) {
 	lua_setfield(L, -2, k->name);
 }
 
-static inline int
-lpairs_group_(lua_State *L, int check) {
-	struct group_iter *iter = lua_touserdata(L, 1);
-	lua_pushcfunction(L, check ? leach_group_check : leach_group_nocheck);
-	lua_pushvalue(L, 1);
+// Push the table of the iterator at iter_index, it's reused in each iteration
+static int
+new_iter_table(lua_State *L, int iter_index, struct group_iter *iter) {
 	lua_createtable(L, 3, iter->nkey);
 	int i;
 	int opt = 0;
@@ -1559,8 +3014,44 @@ lpairs_group_(lua_State *L, int check) {
 	lua_rawseti(L, -2, 1);
 	lua_pushinteger(L, iter->k[0].id); // mainkey
 	lua_rawseti(L, -2, 2);
-	lua_pushvalue(L, 1);
+	lua_pushvalue(L, iter_index);
 	lua_rawseti(L, -2, 3);	// pattern
+	if (iter->changed) {
+		// matches the components written since the last select, including the writes in it
+		iter->since = iter->clock;
+		iter->clock = iter->world->clock++;
+	}
+	reset_cursor(iter);
+	return 1;
+}
+
+// Choose the driver and the cache of the iterator, for the table at the top
+static void
+begin_iter_table(lua_State *L, struct group_iter *iter) {
+	int driver = choose_driver(iter);
+	if (driver > 0) {
+		lua_pushinteger(L, driver);
+		lua_rawseti(L, -2, 4);
+	}
+	if (cache_valid(iter)) {
+		++iter->hit;
+		lua_pushinteger(L, 0);
+		lua_rawseti(L, -2, 6);	// position of cache
+	} else {
+		++iter->miss;
+		lua_pushinteger(L, cache_begin(iter));
+		lua_rawseti(L, -2, 5);	// serial of recording
+	}
+}
+
+static inline int
+lpairs_group_(lua_State *L, int check) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	ecs_flush_(iter->world);
+	lua_pushcfunction(L, check ? leach_group_check : leach_group_nocheck);
+	lua_pushvalue(L, 1);
+	new_iter_table(L, 1, iter);
+	begin_iter_table(L, iter);
 	return 3;
 }
 
@@ -1574,20 +3065,392 @@ lpairs_group_check(lua_State *L) {
 	return lpairs_group_(L, 1);
 }
 
+// The first pattern drives the iteration, the others are matched at the same entity.
+// The tables of the other patterns are the upvalues, and the tables of all the patterns are returned.
+static inline int
+leach_multi_(lua_State *L, int check) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	struct entity_world *w = iter->world;
+	int n = lua_tointeger(L, lua_upvalueindex(1));
+	if (lua_rawgeti(L, 2, 1) != LUA_TNUMBER) {
+		return luaL_error(L, "Invalid group iterator");
+	}
+	int i = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	int j;
+	int index[MAX_COMPONENT];
+	struct ecs_token token;
+	if (i > 0) {
+		// write back in the order of the patterns
+		if (submit_index(L, 2, i-1, check) != iter) {
+			lua_pushvalue(L, 1);
+			lua_rawseti(L, 2, 3);
+		}
+		for (j = 2; j <= n; j++) {
+			int sub_index = lua_upvalueindex(j);
+			struct group_iter *sub = submit_iter(L, sub_index);
+			lua_rawgeti(L, sub_index, 0);
+			token.id = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			// the index may be moved by the submits before
+			int idx = entity_component_index_(w, token, sub->k[0].id);
+			if (idx < 0)
+				return luaL_error(L, "Can't find %s", sub->k[0].name);
+			submit_index(L, sub_index, idx, check);
+		}
+	}
+	for (;;) {
+		if (!next_group(L, iter, i))
+			return 0;
+		lua_settop(L, 2);
+		lua_rawgeti(L, 2, 1);
+		i = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if (entity_fetch_(w, iter->k[0].id, i - 1, &token) == NULL)
+			return luaL_error(L, "Invalid token");
+		for (j = 2; j <= n; j++) {
+			int sub_index = lua_upvalueindex(j);
+			struct group_iter *sub = submit_iter(L, sub_index);
+			if (!match_keys(sub, 0, token, index))
+				break;
+			lua_pushinteger(L, index[0] + 1);
+			lua_rawseti(L, sub_index, 1);
+			lua_pushinteger(L, token.id);
+			lua_rawseti(L, sub_index, 0);
+			read_iter(L, sub_index, sub, index);
+		}
+		if (j > n)
+			break;
+	}
+	// the table of the first pattern is at 2
+	for (j = 2; j <= n; j++) {
+		lua_pushvalue(L, lua_upvalueindex(j));
+	}
+	return n;
+}
+
+static int
+leach_multi_nocheck(lua_State *L) {
+	return leach_multi_(L, 0);
+}
+
+static int
+leach_multi_check(lua_State *L) {
+	return leach_multi_(L, 1);
+}
+
+static inline int
+lpairs_multi_(lua_State *L, int check) {
+	int n = lua_gettop(L);
+	int i;
+	if (n < 1 || n >= MAX_COMPONENT)
+		return luaL_error(L, "Invalid number of patterns %d", n);
+	for (i = 1; i <= n; i++) {
+		luaL_checktype(L, i, LUA_TUSERDATA);
+	}
+	struct group_iter *iter = lua_touserdata(L, 1);
+	ecs_flush_(iter->world);
+	lua_pushinteger(L, n);
+	for (i = 2; i <= n; i++) {
+		struct group_iter *sub = lua_touserdata(L, i);
+		if (sub->world != iter->world)
+			return luaL_error(L, "Patterns of different worlds");
+		new_iter_table(L, i, sub);
+	}
+	lua_pushcclosure(L, check ? leach_multi_check : leach_multi_nocheck, n);
+	lua_pushvalue(L, 1);
+	// only the first one iterates
+	new_iter_table(L, 1, iter);
+	begin_iter_table(L, iter);
+	return 3;
+}
+
+static inline int
+lpairs_multi(lua_State *L) {
+	return lpairs_multi_(L, 0);
+}
+
+static inline int
+lpairs_multi_check(lua_State *L) {
+	return lpairs_multi_(L, 1);
+}
+
+static int
+lquery_stat(lua_State *L) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	lua_pushinteger(L, iter->hit);
+	lua_pushinteger(L, iter->miss);
+	return 2;
+}
+
+struct column_slot {
+	struct group_key *k;
+	struct group_field f;	// offset is 0, the field is at column_field()
+	int key;
+	int offset;	// of the field in struct, or the column for POOL_SOA
+	int lua_index;	// the array or the packed buffer
+	char *buffer;	// NULL for the array
+	int size;	// of each value in buffer
+};
+
+static inline char *
+column_field(struct component_pool *c, struct column_slot *s, int index) {
+	if (c->flags & POOL_SOA)
+		return (char *)get_column(c, s->offset, index);
+	return (char *)get_ptr(c, index) + s->offset;
+}
+
+// Push t[name] (or t[name][field]) to the stack, create the arrays if create is true, or skip the absent ones
+static void
+column_target(lua_State *L, int t_index, struct column_slot *s, int n, int create) {
+	const char *name = s->k->name;
+	int ttype = lua_getfield(L, t_index, name);
+	if (ttype == LUA_TNIL && !create) {
+		lua_pop(L, 1);
+		s->lua_index = 0;
+		return;
+	}
+	if (s->f.key[0]) {
+		if (ttype == LUA_TNIL) {
+			lua_pop(L, 1);
+			lua_newtable(L);
+			lua_pushvalue(L, -1);
+			lua_setfield(L, t_index, name);
+		} else if (ttype != LUA_TTABLE) {
+			luaL_error(L, "Invalid columns .%s (%s)", name, lua_typename(L, ttype));
+		}
+		ttype = lua_getfield(L, -1, s->f.key);
+		lua_remove(L, -2);
+		if (ttype == LUA_TNIL && !create) {
+			lua_pop(L, 1);
+			s->lua_index = 0;
+			return;
+		}
+	}
+	if (ttype == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_createtable(L, n, 0);
+		lua_pushvalue(L, -1);
+		if (s->f.key[0]) {
+			lua_getfield(L, t_index, name);
+			lua_insert(L, -2);
+			lua_setfield(L, -2, s->f.key);
+			lua_pop(L, 1);
+		} else {
+			lua_setfield(L, t_index, name);
+		}
+	} else if (ttype == LUA_TUSERDATA) {
+		if (s->size == 0)
+			luaL_error(L, "Lua object .%s can't be packed", name);
+		if (lua_rawlen(L, -1) < (size_t)n * s->size)
+			luaL_error(L, "The buffer of .%s is too small (%d)", name, n);
+		s->buffer = (char *)lua_touserdata(L, -1);
+	} else if (ttype != LUA_TTABLE) {
+		luaL_error(L, "Invalid columns .%s (%s)", name, lua_typename(L, ttype));
+	}
+	s->lua_index = lua_gettop(L);
+}
+
+// Prepare the slots of the keys with attrib, and push their arrays to the stack
+static int
+column_slots(lua_State *L, struct group_iter *iter, int t_index, int attrib, int n, int create) {
+	int sn = 0;
+	int i, j;
+	for (i = 0; i < iter->nkey; i++) {
+		sn += iter->k[i].field_n + 1;
+	}
+	struct column_slot *slot = (struct column_slot *)lua_newuserdatauv(L, sn * sizeof(struct column_slot), 0);
+	luaL_checkstack(L, sn, NULL);
+	sn = 0;
+	struct group_field *f = iter->f;
+	for (i = 0; i < iter->nkey; i++) {
+		struct group_key *k = &iter->k[i];
+		if ((k->attrib & attrib) && !(k->attrib & COMPONENT_FILTER)) {
+			if (is_temporary(k->attrib))
+				return luaL_error(L, "Columns doesn't support .%s:new", k->name);
+			if (k->id == ENTITYID_TAG || iter->world->c[k->id].stride <= 0) {
+				struct column_slot *s = &slot[sn++];
+				s->k = k;
+				s->key = i;
+				s->f.key[0] = 0;
+				s->buffer = NULL;
+				if (k->id == ENTITYID_TAG)
+					s->size = sizeof(uint64_t);
+				else if (iter->world->c[k->id].stride == STRIDE_TAG)
+					s->size = sizeof(uint8_t);
+				else
+					s->size = 0;	// lua object
+				if (attrib == COMPONENT_OUT && s->size != 0)
+					return luaL_error(L, "Columns can't write .%s", k->name);
+				column_target(L, t_index, s, n, create);
+			} else {
+				struct component_pool *c = &iter->world->c[k->id];
+				for (j = 0; j < k->field_n; j++) {
+					struct column_slot *s = &slot[sn++];
+					s->k = k;
+					s->key = i;
+					s->f = f[j];
+					s->f.offset = 0;
+					s->offset = f[j].offset;
+					if (c->flags & POOL_SOA) {
+						int col;
+						for (col = 0; col < c->column_n; col++) {
+							if (c->column[col].offset == f[j].offset)
+								break;
+						}
+						if (col >= c->column_n)
+							return luaL_error(L, "Invalid field .%s.%s", k->name, f[j].key);
+						s->offset = col;
+					}
+					s->buffer = NULL;
+					s->size = sizeof_type[f[j].type];
+					column_target(L, t_index, s, n, create);
+				}
+			}
+		}
+		f += k->field_n;
+	}
+	return sn;
+}
+
+static void
+column_read(lua_State *L, struct group_iter *iter, struct column_slot *s, int i, int index) {
+	struct entity_world *w = iter->world;
+	int id = s->k->id;
+	if (s->buffer) {
+		char *ptr = s->buffer + (size_t)i * s->size;
+		if (index < 0) {
+			memset(ptr, 0, s->size);
+		} else if (id == ENTITYID_TAG) {
+			*(uint64_t *)ptr = w->eid.id[index];
+		} else if (w->c[id].stride == STRIDE_TAG) {
+			*(uint8_t *)ptr = 1;
+		} else {
+			memcpy(ptr, column_field(&w->c[id], s, index), s->size);
+		}
+		return;
+	}
+	if (id == ENTITYID_TAG) {
+		lua_pushinteger(L, w->eid.id[index]);
+	} else {
+		struct component_pool *c = &w->c[id];
+		if (c->stride == STRIDE_TAG) {
+			lua_pushboolean(L, index >= 0);
+		} else if (c->stride == STRIDE_LUA) {
+			get_lua_component(L, w, c, index);
+		} else if (index < 0) {
+			lua_pushnil(L);
+		} else {
+			read_value(L, &s->f, column_field(c, s, index));
+		}
+	}
+	lua_rawseti(L, s->lua_index, i + 1);
+}
+
+static void
+column_write(lua_State *L, struct group_iter *iter, struct column_slot *s, int i, int index) {
+	struct entity_world *w = iter->world;
+	struct component_pool *c = &w->c[s->k->id];
+	if (index < 0 || s->lua_index == 0)
+		return;
+	if (s->buffer) {
+		memcpy(column_field(c, s, index), s->buffer + (size_t)i * s->size, s->size);
+	} else {
+		lua_rawgeti(L, s->lua_index, i + 1);
+		if (c->stride == STRIDE_LUA) {
+			set_lua_component(L, w, c, index);
+			return;
+		}
+		write_value(L, &s->f, column_field(c, s, index));
+	}
+	ecs_touch_(w, c, index, 1);
+}
+
+// the i-th match of the cache buffer
+static void
+column_match(lua_State *L, struct group_iter *iter, int i, int index[MAX_COMPONENT]) {
+	int cap;
+	int *buf = cache_buffer(L, 1, &cap);
+	struct ecs_token token;
+	index[0] = buf[i];
+	if (entity_fetch_(iter->world, iter->k[0].id, buf[i], &token) == NULL || !match_keys(iter, 1, token, index))
+		luaL_error(L, "Invalid query cache");
+}
+
+static int
+lcolumns(lua_State *L) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	ecs_flush_(iter->world);
+	if (iter->changed) {
+		iter->since = iter->clock;
+		iter->clock = iter->world->clock++;
+	}
+	int n = collect_matches(L, 1, iter);
+	iter->columns_n = n;
+	int sn = column_slots(L, iter, 2, COMPONENT_IN, n, 1);
+	struct column_slot *slot = (struct column_slot *)lua_touserdata(L, 3);
+	int index[MAX_COMPONENT];
+	int i, j;
+	for (i = 0; i < n; i++) {
+		column_match(L, iter, i, index);
+		for (j = 0; j < sn; j++) {
+			column_read(L, iter, &slot[j], i, index[slot[j].key]);
+		}
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+static int
+lsubmit_columns(lua_State *L) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	ecs_flush_(iter->world);
+	int n = iter->columns_n;
+	if (n < 0 || !cache_versions_unchanged(iter))
+		return luaL_error(L, "The matches changed after columns");
+	int sn = column_slots(L, iter, 2, COMPONENT_OUT, n, 0);
+	struct column_slot *slot = (struct column_slot *)lua_touserdata(L, 3);
+	int index[MAX_COMPONENT];
+	int i, j;
+	for (i = 0; i < n; i++) {
+		column_match(L, iter, i, index);
+		for (j = 0; j < sn; j++) {
+			column_write(L, iter, &slot[j], i, index[slot[j].key]);
+		}
+	}
+	return 0;
+}
+
 static int
 lfirst(lua_State *L) {
 	struct group_iter *iter = lua_touserdata(L, 2);
 	int mainkey = iter->k[0].id;
 	int index[MAX_COMPONENT];
 	int idx = -1;
-
-	for (;;) {
-		int ret = query_index(iter, 1, mainkey, &idx, index, NULL);
-		if (ret < 0)
-			return 0;
-		if (ret > 0)
-			break;
+	int ret;
+	ecs_flush_(iter->world);
+	reset_cursor(iter);
+	uint32_t since = iter->since;
+	iter->since = iter->clock;
+
+	int driver = choose_driver(iter);
+	if (driver > 0) {
+		struct ecs_token token;
+		int pos = -1;
+		token.id = -1;
+		while ((ret = query_driver(iter, driver, &pos, &idx, index, &token)) == 0)
+			;
+	} else {
+		while ((ret = query_index(iter, 1, mainkey, &idx, index, NULL)) == 0)
+			;
 	}
+	iter->since = since;
+	if (ret < 0)
+		return 0;
 	index[0] = idx;
 
 	if (lua_type(L, 3) == LUA_TTABLE) {
@@ -1678,6 +3541,12 @@ get_key(struct entity_world *w, lua_State *L, struct group_key *key, struct grou
 	if (check_boolean(L, "absent")) {
 		attrib |= COMPONENT_ABSENT;
 	}
+	if (check_boolean(L, "changed")) {
+		if (key->id < 0 || !(w->c[key->id].flags & POOL_CHANGED)) {
+			return luaL_error(L, "%s isn't registered with changed = true", key->name);
+		}
+		attrib |= COMPONENT_CHANGED;
+	}
 	if ((attrib & COMPONENT_FILTER) &&
 		(attrib & (COMPONENT_IN | COMPONENT_OUT))) {
 		return luaL_error(L, "filter attrib can't be in/out");
@@ -1767,18 +3636,34 @@ need_input(lua_State *L, struct group_iter *iter, struct group_iter *patch, int
 }
 
 static struct group_iter *
-create_group_iter(lua_State *L, int nkey, int field_n) {
+create_group_iter(lua_State *L, int nkey, int field_n, int pred_n) {
 	size_t header_size = sizeof(struct group_iter) + sizeof(struct group_key) * (nkey - 1);
 	const int align_size = sizeof(void *);
 	// align
 	header_size = (header_size + align_size - 1) & ~(align_size - 1);
-	size_t size = header_size + field_n * sizeof(struct group_field);
-	struct group_iter *iter = (struct group_iter *)lua_newuserdatauv(L, size, 1);
+	size_t pred_offset = header_size + field_n * sizeof(struct group_field);
+	pred_offset = (pred_offset + sizeof(int64_t) - 1) & ~(sizeof(int64_t) - 1);
+	size_t size = pred_offset + pred_n * sizeof(struct group_pred);
+	struct group_iter *iter = (struct group_iter *)lua_newuserdatauv(L, size, 2);
 	// refer world
 	struct group_field *f = (struct group_field *)((char *)iter + header_size);
 	iter->nkey = nkey;
 	iter->f = f;
+	iter->p = (struct group_pred *)((char *)iter + pred_offset);
+	iter->pred_n = pred_n;
+	iter->param_n = 0;
 	iter->readonly = 1;
+	iter->cache_n = -1;
+	iter->record_n = 0;
+	iter->columns_n = -1;
+	iter->count_n = -1;
+	iter->serial = 0;
+	iter->hit = 0;
+	iter->miss = 0;
+	iter->changed = 0;
+	iter->since = 0;
+	iter->clock = 0;
+	reset_cursor(iter);
 	return iter;
 }
 
@@ -1798,7 +3683,7 @@ generate_diff(lua_State *L, struct group_iter *origin, struct group_iter *ext) {
 	}
 	if (origin->world != ext->world)
 		luaL_error(L, "Different world");
-	struct group_iter *iter = create_group_iter(L, n, field_n);
+	struct group_iter *iter = create_group_iter(L, n, field_n, 0);
 	iter->world = origin->world;
 	struct group_field *f = iter->f;
 	struct group_key *key = &iter->k[0];
@@ -1869,7 +3754,7 @@ generate_merge(lua_State *L, struct group_iter *origin, struct group_iter *ext)
 	for (i=0;i<origin->nkey;i++) {
 		origin_field_n += origin->k[i].field_n;
 	}
-	struct group_iter *iter = create_group_iter(L, n+origin->nkey, field_n + origin_field_n);
+	struct group_iter *iter = create_group_iter(L, n+origin->nkey, field_n + origin_field_n, 0);
 	iter->world = origin->world;
 	iter->readonly = origin->readonly;
 	if (!ext->readonly) {
@@ -1944,12 +3829,104 @@ lmergeiter(lua_State *L) {
 	return 2;
 }
 
+static int
+get_pred_op(lua_State *L, const char *op) {
+	static const char *ops[] = { "==", "~=", "<", "<=", ">", ">=", NULL };
+	int i;
+	for (i = 0; ops[i]; i++) {
+		if (strcmp(ops[i], op) == 0)
+			return i;
+	}
+	return luaL_error(L, "Invalid predicate op %s", op);
+}
+
+static void
+set_pred_value(lua_State *L, struct group_pred *p, int index) {
+	if (lua_type(L, index) == LUA_TBOOLEAN) {
+		p->isint = 1;
+		p->i = lua_toboolean(L, index);
+		p->n = (double)p->i;
+		return;
+	}
+	p->isint = lua_isinteger(L, index);
+	p->i = lua_tointeger(L, index);
+	p->n = luaL_checknumber(L, index);
+}
+
+// key.pred = { { offset, type, op, value, param }, ... }, returns the number of predicates so far
+static int
+get_pred(struct entity_world *w, lua_State *L, struct group_iter *iter, int key, int pred_n) {
+	struct group_key *k = &iter->k[key];
+	if (lua_getfield(L, -1, "pred") != LUA_TTABLE) {
+		lua_pop(L, 1);
+		return pred_n;
+	}
+	struct component_pool *c = &w->c[k->id];
+	if (k->id < 0 || c->stride <= 0 || (k->attrib & (COMPONENT_OPTIONAL | COMPONENT_ABSENT)) || is_temporary(k->attrib)) {
+		return luaL_error(L, "Predicate of .%s should be on the required C component", k->name);
+	}
+	int n = get_len(L, -1);
+	int i;
+	for (i = 0; i < n; i++) {
+		struct group_pred *p = &iter->p[pred_n++];
+		if (lua_geti(L, -1, i + 1) != LUA_TTABLE) {
+			return luaL_error(L, "Invalid predicate of .%s", k->name);
+		}
+		p->key = key;
+		lua_geti(L, -1, 1);
+		p->offset = luaL_checkinteger(L, -1);
+		lua_geti(L, -2, 2);
+		p->type = luaL_checkinteger(L, -1);
+		if (p->type < 0 || p->type >= TYPE_USERDATA)
+			return luaL_error(L, "Invalid predicate type of .%s", k->name);
+		lua_geti(L, -3, 3);
+		p->op = get_pred_op(L, luaL_checkstring(L, -1));
+		lua_geti(L, -4, 4);
+		set_pred_value(L, p, -1);
+		lua_geti(L, -5, 5);
+		p->param = (int)luaL_optinteger(L, -1, 0);
+		if (p->param > iter->param_n)
+			iter->param_n = p->param;
+		lua_pop(L, 6);
+		if (c->flags & POOL_SOA) {
+			int col;
+			for (col = 0; col < c->column_n; col++) {
+				if (c->column[col].offset == p->offset)
+					break;
+			}
+			if (col >= c->column_n)
+				return luaL_error(L, "Invalid predicate offset of .%s", k->name);
+			p->offset = col;
+		}
+	}
+	lua_pop(L, 1);
+	return pred_n;
+}
+
+// iter, values of the predicates ...
+static int
+lbind(lua_State *L) {
+	struct group_iter *iter = lua_touserdata(L, 1);
+	int n = lua_gettop(L) - 1;
+	if (n != iter->param_n)
+		return luaL_error(L, "The pattern needs %d values, got %d", iter->param_n, n);
+	int i;
+	for (i = 0; i < iter->pred_n; i++) {
+		struct group_pred *p = &iter->p[i];
+		if (p->param)
+			set_pred_value(L, p, p->param + 1);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
 static int
 lgroupiter(lua_State *L) {
 	struct entity_world *w = getW(L);
 	luaL_checktype(L, 2, LUA_TTABLE);
 	int nkey = get_len(L, 2);
 	int field_n = 0;
+	int pred_n = 0;
 	int i;
 	if (nkey == 0) {
 		return luaL_error(L, "At least one key");
@@ -1969,13 +3946,16 @@ lgroupiter(lua_State *L) {
 			}
 		}
 		field_n += n;
-		lua_pop(L, 1);
+		if (lua_getfield(L, -1, "pred") == LUA_TTABLE)
+			pred_n += get_len(L, -1);
+		lua_pop(L, 2);
 	}
-	struct group_iter *iter = create_group_iter(L, nkey, field_n);
+	struct group_iter *iter = create_group_iter(L, nkey, field_n, pred_n);
 	lua_pushvalue(L, 1);
 	lua_setiuservalue(L, -2, 1);
 	iter->world = w;
 	struct group_field *f = iter->f;
+	pred_n = 0;
 	for (i = 0; i < nkey; i++) {
 		lua_geti(L, 2, i + 1);
 		int n = get_key(w, L, &iter->k[i], f);
@@ -1984,6 +3964,7 @@ lgroupiter(lua_State *L) {
 			return luaL_error(L, "%s is a tag, use %s?out instead", iter->k[i].name, iter->k[i].name);
 		}
 		f += n;
+		pred_n = get_pred(w, L, iter, i, pred_n);
 		lua_pop(L, 1);
 		if (c->stride == STRIDE_LUA) {
 			if (n != 0)
@@ -1991,11 +3972,16 @@ lgroupiter(lua_State *L) {
 			iter->k[i].attrib |= COMPONENT_OBJECT;
 		}
 		int attrib = iter->k[i].attrib;
+		if (i > 0 && iter->k[i].id >= 0 && !(attrib & (COMPONENT_OPTIONAL | COMPONENT_ABSENT)) && !is_temporary(attrib)) {
+			iter->k[i].attrib |= COMPONENT_DRIVER;
+		}
 		if (!(attrib & COMPONENT_FILTER)) {
 			int readonly = (attrib & COMPONENT_IN) && !(attrib & COMPONENT_OUT);
 			if (!readonly)
 				iter->readonly = 0;
 		}
+		if (attrib & COMPONENT_CHANGED)
+			iter->changed = 1;
 	}
 	int mainkey_attrib = iter->k[0].attrib;
 	if (mainkey_attrib & COMPONENT_ABSENT) {
@@ -2098,7 +4084,7 @@ lobject_(lua_State *L, write_object_func write_component) {
 	}
 	lua_settop(L, 2);
 	struct component_pool *c = &w->c[cid];
-	if (c->n <= index) {
+	if ((c->flags & POOL_BITSET) ? index >= c->cap : c->n + c->pending <= index) {
 		return luaL_error(L, "No object %d", cid);
 	}
 	if (c->stride == STRIDE_LUA) {
@@ -2124,7 +4110,7 @@ lobject_(lua_State *L, write_object_func write_component) {
 	} else if (c->stride < 0) {
 		return luaL_error(L, "Invalid object %d", cid);
 	}
-	void *buffer = get_ptr(c, index);
+	void *buffer = get_record(c, index);
 	if (lua_isnoneornil(L, 2)) {
 		ecs_read_object_(L, iter, buffer);
 	} else {
@@ -2134,12 +4120,14 @@ lobject_(lua_State *L, write_object_func write_component) {
 			if (sz != c->stride) {
 				return luaL_error(L, "rawdata need %d bytes, it's %d.", c->stride, (int)sz);
 			}
-			memcpy(buffer, raw, sz);
+			set_record(c, index, raw);
 		} else {
 			// write object
 			lua_pushvalue(L, 2);
 			write_component(L, iter->k[0].field_n, iter->f, buffer);
+			set_record(c, index, buffer);
 		}
+		ecs_touch_(w, c, index, 1);
 	}
 	return 1;
 }
@@ -2157,14 +4145,17 @@ lobject_withcheck(lua_State *L) {
 static int
 ldumpid(lua_State *L) {
 	struct entity_world *w = getW(L);
+	ecs_flush_(w);
 	int cid = luaL_checkinteger(L, 2);
 	if (cid == ENTITYID_TAG) {
 		int n = w->eid.n;
-		lua_createtable(L, n, 0);
-		int i;
+		lua_createtable(L, n - w->eid.free_n, 0);
+		int i, j = 0;
 		for (i = 0; i<n ; i++) {
-			lua_pushinteger(L, w->eid.id[i]);
-			lua_rawseti(L, -2, i+1);
+			if (!entity_id_isfree(&w->eid, i)) {
+				lua_pushinteger(L, w->eid.id[i]);
+				lua_rawseti(L, -2, ++j);
+			}
 		}
 		return 1;
 	}
@@ -2172,10 +4163,59 @@ ldumpid(lua_State *L) {
 	struct component_pool *c = &w->c[cid];
 	lua_createtable(L, c->n, 0);
 	int i;
+	if (c->flags & POOL_BITSET) {
+		int idx = -1;
+		for (i = 0; (idx = bitset_next(c, idx + 1)) >= 0; i++) {
+			lua_pushinteger(L, w->eid.id[idx]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		return 1;
+	}
+	int n = 0;
 	for (i = 0; i < c->n; i++) {
+		if (tomb_test(c, i))
+			continue;
 		entity_index_t index = c->id[i];
 		lua_pushinteger(L, ENTITY_EID(w, index));
-		lua_rawseti(L, -2, i + 1);
+		lua_rawseti(L, -2, ++n);
+	}
+	return 1;
+}
+
+// All the tags are bitsets, filter word by word
+static int
+filter_bitset(struct entity_world *w, int tagid, struct group_iter *iter) {
+	struct component_pool *tag = &w->c[tagid];
+	if (!(tag->flags & POOL_BITSET))
+		return 0;
+	int i, j;
+	for (i = 0; i < iter->nkey; i++) {
+		struct group_key *k = &iter->k[i];
+		if (k->id < 0 || !(w->c[k->id].flags & POOL_BITSET) || (k->attrib & COMPONENT_OPTIONAL) || is_temporary(k->attrib))
+			return 0;
+	}
+	struct component_pool *main = &w->c[iter->k[0].id];
+	if (main->n == 0)
+		return 1;
+	bitset_reserve(tag, main->cap - 1);
+	int words = main->cap >> 6;
+	for (i = 0; i < words; i++) {
+		uint64_t v = main->bits[i];
+		for (j = 1; j < iter->nkey && v; j++) {
+			struct group_key *k = &iter->k[j];
+			struct component_pool *c = &w->c[k->id];
+			uint64_t b = (i < (c->cap >> 6)) ? c->bits[i] : 0;
+			if (k->attrib & COMPONENT_ABSENT)
+				v &= ~b;
+			else
+				v &= b;
+		}
+		v &= ~tag->bits[i];
+		if (v) {
+			tag->bits[i] |= v;
+			tag->n += __builtin_popcountll(v);
+			++tag->version;
+		}
 	}
 	return 1;
 }
@@ -2185,15 +4225,19 @@ lfilter(lua_State *L) {
 	struct entity_world *w = getW(L);
 	int tagid = check_cid(L, w, 2);
 	struct group_iter *iter = check_groupiter(L, 3);
+	ecs_flush_(w);
 	if (lua_toboolean(L, 4) == 0)
 		entity_clear_type_(w, tagid);
+	if (filter_bitset(w, tagid, iter))
+		return 0;
 	int mainkey = iter->k[0].id;
 	int i,j;
 	struct ecs_token token;
+	reset_cursor(iter);
 	for (i = -1; (i=entity_next_tag_(w, mainkey, i, &token)) >=0;) {
 		for (j = 1; j < iter->nkey; j++) {
 			struct group_key *k = &iter->k[j];
-			if ((entity_component_index_(w, token, k->id) >= 0) ^ (!(k->attrib & COMPONENT_ABSENT))) {
+			if ((cursor_index(w, k, token) >= 0) ^ (!(k->attrib & COMPONENT_ABSENT))) {
 				break;
 			}
 		}
@@ -2259,9 +4303,11 @@ laccess(lua_State *L) {
 	}
 
 	// It is C component
-	void *buffer = get_ptr(c, index);
+	void *buffer = get_record(c, index);
 	if (output) {
 		ecs_write_component_object_(L, k->field_n, iter->f, buffer);
+		set_record(c, index, buffer);
+		ecs_touch_(w, c, index, 1);
 		return 0;
 	} else {
 		ecs_read_object_(L, iter, buffer);
@@ -2324,13 +4370,18 @@ lswap_component(lua_State *L) {
 	int cid2 = check_cid(L, w, 3);
 	struct component_pool *c1 = &w->c[cid1];
 	struct component_pool *c2 = &w->c[cid2];
-	if (c1->stride != c2->stride) {
+	ecs_flush_(w);
+	if (c1->stride != c2->stride || (c1->flags & (POOL_SOA | POOL_PAGED | POOL_TRANSIENT)) != (c2->flags & (POOL_SOA | POOL_PAGED | POOL_TRANSIENT))) {
 		return luaL_error(L, "Not the same type %d,%d", cid1, cid2);
 	}
 	struct component_pool tmp = *c1;
 	*c1 = *c2;
 	*c2 = tmp;
-	if (tmp.stride > 0) {
+	// the versions must be newer than both
+	unsigned int version = (c1->version > c2->version ? c1->version : c2->version) + 1;
+	c1->version = version;
+	c2->version = version;
+	if (tmp.stride > 0 && !(tmp.flags & POOL_PAGED)) {
 		lua_pushlightuserdata(L, tmp.buffer);
 		return 1;
 	} else {
@@ -2350,14 +4401,55 @@ lpropagate(lua_State *L) {
 	return 0;
 }
 
+static int
+lpropagate_all(lua_State *L) {
+	struct entity_world *w = getW(L);
+	int cid = check_cid(L, w, 2);
+	int tag = check_cid(L, w, 3);
+	int n = entity_propagate_all_(w, cid, tag);
+	if (n < 0) {
+		return luaL_error(L, "Invalid components type");
+	}
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+// 1: world
+// 2: op
+// 3: dst tag
+// 4...: sources
+static int
+ltag_op(lua_State *L) {
+	struct entity_world *w = getW(L);
+	int op = luaL_checkinteger(L, 2);
+	int dst = check_tagid(L, w, 3);
+	int n = lua_gettop(L) - 3;
+	if (n <= 0 || n > MAX_COMPONENT)
+		return luaL_error(L, "Invalid number of tags %d", n);
+	int src[MAX_COMPONENT];
+	int i;
+	for (i = 0; i < n; i++) {
+		src[i] = check_cid(L, w, 4 + i);
+	}
+	int r = entity_tag_op_(w, op, dst, n, src);
+	if (r < 0)
+		return luaL_error(L, "Invalid tag op %d", op);
+	lua_pushinteger(L, r);
+	return 1;
+}
+
 static int
 lmethods(lua_State *L) {
 	int debug = lua_toboolean(L, 1);
 	luaL_Reg m[] = {
 		{ "memory", lcount_memory },
+		{ "update_stat", lupdate_stat },
+		{ "memory_stat", lmemory_stat },
+		{ "clear_transient", lclear_transient },
 		{ "collect", lcollect_memory },
 		{ "_newtype", lnew_type },
 		{ "_newentity", lnew_entity },
+		{ "_clone", lclone_entity },
 		{ "_indexentity", lindex_entity },
 		{ "_addcomponent", ladd_component },
 		{ "_findcomponent", lfind_component },
@@ -2368,6 +4460,7 @@ lmethods(lua_State *L) {
 		{ "context", lcontext },
 		{ "_groupiter", lgroupiter },
 		{ "_mergeiter", lmergeiter },
+		{ "_bind", lbind },
 		{ "_fetch", lfetch },
 		{ "exist", lexist },
 		{ "remove", lremove },
@@ -2378,6 +4471,9 @@ lmethods(lua_State *L) {
 		{ "_first", lfirst },
 		{ "_dumpid", ldumpid },
 		{ "_count", lcount },
+		{ "_query_stat", lquery_stat },
+		{ "_columns", lcolumns },
+		{ "_submit_columns", lsubmit_columns },
 		{ "_filter", lfilter },
 		{ "_access", laccess },
 		{ "__gc", ldeinit_world },
@@ -2386,7 +4482,10 @@ lmethods(lua_State *L) {
 		{ "group_get", lgroup_get },
 		{ "_swap", lswap_component },
 		{ "_pairs", lpairs_group },
+		{ "_pairs_multi", lpairs_multi },
 		{ "_propagate", lpropagate },
+		{ "_propagate_all", lpropagate_all },
+		{ "_tag_op", ltag_op },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L, m);
@@ -2394,6 +4493,7 @@ lmethods(lua_State *L) {
 		luaL_Reg patch[] = {
 			{ "_object_check", lobject_withcheck },
 			{ "_pairs", lpairs_group_check },
+			{ "_pairs_multi", lpairs_multi_check },
 			{ NULL, NULL },
 		};
 		luaL_setfuncs(L, patch, 0);
@@ -2437,6 +4537,18 @@ luaopen_ecs_core(lua_State *L) {
 	lua_setfield(L, -2, "_TYPEUSERDATA");
 	lua_pushinteger(L, STRIDE_LUA);
 	lua_setfield(L, -2, "_LUAOBJECT");
+	lua_pushinteger(L, POOL_SPARSE);
+	lua_setfield(L, -2, "_SPARSE");
+	lua_pushinteger(L, POOL_SOA);
+	lua_setfield(L, -2, "_SOA");
+	lua_pushinteger(L, POOL_PAGED);
+	lua_setfield(L, -2, "_PAGED");
+	lua_pushinteger(L, POOL_TRANSIENT);
+	lua_setfield(L, -2, "_TRANSIENT");
+	lua_pushinteger(L, POOL_CHANGED);
+	lua_setfield(L, -2, "_CHANGED");
+	lua_pushinteger(L, POOL_BITSET);
+	lua_setfield(L, -2, "_BITSET");
 	lua_pushinteger(L, ENTITY_REMOVED);
 	lua_setfield(L, -2, "_REMOVED");
 	lua_pushinteger(L, ENTITYID_TAG);
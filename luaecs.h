@@ -6,10 +6,21 @@
 
 #define COMPONENT_EID -1
 
+// op of entity_tag_op
+#define ECS_TAG_UNION 0
+#define ECS_TAG_INTERSECT 1
+#define ECS_TAG_SUBTRACT 2
+
 struct entity_world;
 struct ecs_cache;
 struct ecs_token { int id; };
 
+// ecs.world(predefined, { alloc = lightuserdata(struct ecs_alloc_hook *) }), it should outlive the world
+struct ecs_alloc_hook {
+	void * (*alloc)(void *ud, void *ptr, size_t osize, size_t nsize);	// the same as lua_Alloc
+	void *ud;
+};
+
 struct ecs_capi {
 	void *(*fetch)(struct entity_world *w, int cid, int index, struct ecs_token *t);
 	void (*clear_type)(struct entity_world *w, int cid);
@@ -32,6 +43,18 @@ struct ecs_capi {
 	void* (*cache_fetch)(struct ecs_cache *, int index, int cid);
 	int (*cache_fetch_index)(struct ecs_cache *, int index, int cid);
 	int (*cache_sync)(struct ecs_cache *);
+	void *(*column)(struct entity_world *w, int cid, int offset, int *stride);
+	int (*new_batch)(struct entity_world *w, int n, int cn, const int cid[], const void *proto[], struct ecs_token *t);
+	int (*join)(struct entity_world *w, int n, const int cid[], int index[], struct ecs_token *t);
+	void (*changed)(struct entity_world *w, int cid, int index);
+	int (*span)(struct entity_world *w, int n, const int cid[], int index[], void *ptr[], struct ecs_token *t);
+	int (*component_index_r)(struct entity_world *w, struct ecs_token t, int cid, int *cursor);
+	int (*index_r)(struct entity_world *w, void *eid, int *hint);
+	int (*split)(struct entity_world *w, int n, const int cid[], int nrange, int range[]);
+	int (*tag_op)(struct entity_world *w, int op, int dst, int n, const int src[]);
+	int (*hierarchy)(struct entity_world *w, int cid, const int **order, const int **parent);
+	int (*propagate_all)(struct entity_world *w, int cid, int tag_id);
+	void *(*fetch_r)(struct entity_world *w, int cid, int index, struct ecs_token *t);
 };
 
 struct ecs_context {
@@ -39,6 +62,8 @@ struct ecs_context {
 	struct entity_world *world;
 };
 
+// For a component of layout = "soa", returns a dummy pointer (like a tag) which can't be dereferenced, the fields are in columns, use entity_column.
+// A bitset tag has no dense rows, don't fetch it (asserts), iterate it by entity_next.
 static inline void *
 entity_fetch(struct ecs_context *ctx, int id, int index, struct ecs_token *t) {
 	return ctx->api->fetch(ctx->world, id, index, t);
@@ -49,6 +74,7 @@ entity_clear_type(struct ecs_context *ctx, int id) {
 	ctx->api->clear_type(ctx->world, id);
 }
 
+// A dummy pointer for layout = "soa" too, use entity_component_index and entity_column.
 static inline void *
 entity_component(struct ecs_context *ctx, struct ecs_token t, int cid) {
 	return ctx->api->component(ctx->world, t, cid);
@@ -133,6 +159,21 @@ entity_propagate_tag(struct ecs_context *ctx, int cid, int tag_id) {
 	return ctx->api->propagate_tag(ctx->world, cid, tag_id);
 }
 
+// Propagate the tag down all the levels of the hierarchy of cid (the first field is the eid of parent).
+// Returns the number of tags added.
+static inline int
+entity_propagate_all(struct ecs_context *ctx, int cid, int tag_id) {
+	return ctx->api->propagate_all(ctx->world, cid, tag_id);
+}
+
+// The rows of cid with the parents before the children, and the row of the parent of each row (-1 if the parent
+// has not cid). Returns the number of rows in order, the rows in cycles are excluded.
+// The arrays are valid until cid or the entities change.
+static inline int
+entity_hierarchy(struct ecs_context *ctx, int cid, const int **order, const int **parent) {
+	return ctx->api->hierarchy(ctx->world, cid, order, parent);
+}
+
 static inline struct ecs_cache *
 entity_cache_create(struct ecs_context *ctx, int keys[], int n) {
 	return ctx->api->cache_create(ctx->world, keys, n);
@@ -158,4 +199,96 @@ entity_cache_sync(struct ecs_context *ctx, struct ecs_cache *c) {
 	return ctx->api->cache_sync(c);
 }
 
+// The field at offset of the first component; the next one is at +stride bytes. NULL for paged components.
+static inline void *
+entity_column(struct ecs_context *ctx, int cid, int offset, int *stride) {
+	return ctx->api->column(ctx->world, cid, offset, stride);
+}
+
+// New n entities with the components cid[], proto[] (can be NULL) is the initial value.
+// The tokens are [t->id, t->id + n)
+static inline int
+entity_new_batch(struct ecs_context *ctx, int n, int cn, const int cid[], const void *proto[], struct ecs_token *t) {
+	return ctx->api->new_batch(ctx->world, n, cn, cid, proto, t);
+}
+
+// Iterate the entities with all the components cid[] (n > 0), in the order of entity.
+// Set t->id = -1 and index[0..n) = 0 first, then index[i] is the position in the pool cid[i].
+//	while (entity_join(ctx, n, cid, index, &t)) { ... }
+static inline int
+entity_join(struct ecs_context *ctx, int n, const int cid[], int index[], struct ecs_token *t) {
+	return ctx->api->join(ctx->world, n, cid, index, t);
+}
+
+// Mark the component written by the pointer, for the :changed select. (registered with changed = true)
+static inline void
+entity_changed(struct ecs_context *ctx, int cid, int index) {
+	ctx->api->changed(ctx->world, cid, index);
+}
+
+// Iterate the runs of rows which are consecutive in all the pools cid[], returns the number of rows in the run (0 at the end).
+// The state is the same as entity_join. index[i] is the first row of the run in the pool cid[i], and ptr[i] is its address
+// (NULL for tag, lua object and soa layout).
+//	while ((n = entity_span(ctx, 3, cid, index, ptr, &t))) { ... }
+static inline int
+entity_span(struct ecs_context *ctx, int n, const int cid[], int index[], void *ptr[], struct ecs_token *t) {
+	return ctx->api->span(ctx->world, n, cid, index, ptr, t);
+}
+
+// Reentrant lookups for the worker threads, the cursor (or hint) is the caller's, initialize it to 0.
+// entity_component / entity_component_index aren't, they update the lookup cache in the world.
+// The staged components should be merged by entity_split before (asserts).
+static inline int
+entity_component_index_r(struct ecs_context *ctx, struct ecs_token t, int cid, int *cursor) {
+	return ctx->api->component_index_r(ctx->world, t, cid, cursor);
+}
+
+static inline void *
+entity_component_r(struct ecs_context *ctx, struct ecs_token t, int cid, int *cursor) {
+	int id = ctx->api->component_index_r(ctx->world, t, cid, cursor);
+	if (id < 0)
+		return NULL;
+	return ctx->api->fetch_r(ctx->world, cid, id, NULL);
+}
+
+// The same as entity_fetch, but the index of a bitset tag is the entity index (NULL if the tag is absent)
+static inline void *
+entity_fetch_r(struct ecs_context *ctx, int id, int index, struct ecs_token *t) {
+	return ctx->api->fetch_r(ctx->world, id, index, t);
+}
+
+static inline int
+entity_index_r(struct ecs_context *ctx, void *eid, int *hint) {
+	return ctx->api->index_r(ctx->world, eid, hint);
+}
+
+// Parallel for : split the join of cid[] into nrange ranges by the rows of the driver pool, returns the driver.
+// Call it before the workers start, then the world should be read only until they finish.
+static inline int
+entity_split(struct ecs_context *ctx, int n, const int cid[], int nrange, int range[]) {
+	return ctx->api->split(ctx->world, n, cid, nrange, range);
+}
+
+// Begin to join the rows [from, to) of the driver pool in a worker
+//	entity_join_begin(ctx, n, cid, driver, range[i], index, &t);
+//	while (entity_join(ctx, n, cid, index, &t) && index[driver] < range[i+1]) { ... }
+static inline void
+entity_join_begin(struct ecs_context *ctx, int n, const int cid[], int driver, int from, int index[], struct ecs_token *t) {
+	int i;
+	for (i = 0; i < n; i++) {
+		index[i] = 0;
+	}
+	index[driver] = from;
+	t->id = -1;
+	if (from > 0)
+		ctx->api->fetch_r(ctx->world, cid[driver], from - 1, t);
+}
+
+// The tag dst = src[0] op src[1] op ... src[n-1], returns the number of tags in dst.
+// The sources can be any components (and dst itself), the entities of them are merged in order.
+static inline int
+entity_tag_op(struct ecs_context *ctx, int op, int dst, int n, const int src[]) {
+	return ctx->api->tag_op(ctx->world, op, dst, n, src);
+}
+
 #endif
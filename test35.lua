@@ -13,11 +13,12 @@ w:register {
 }
 
 for i = 1, 10 do
-	w:new { A = i }
-	w:new { B = -i }
+	w:new { A = i, B = -i }
+	w:new { B = i }
 end
 
 for a,b in w:select2("A:in", "B:in") do
 	print(a.A, b.B)
+	assert(a.A == -b.B)
 end
 
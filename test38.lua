@@ -0,0 +1,98 @@
+-- sparse index
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "value",
+	type = "int",
+}
+
+w:register {
+	name = "svalue",
+	type = "int",
+	sparse = true,
+}
+
+w:register {
+	name = "stag",
+	sparse = true,
+}
+
+w:register {
+	name = "sobj",
+	type = "lua",
+	sparse = true,
+}
+
+local N = 100
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new { value = i }
+end
+
+-- add components out of order
+for i = N, 1, -3 do
+	w:import(eids[i], { svalue = i, sobj = "obj" .. i })
+end
+
+for i = 1, N, 2 do
+	w:access(eids[i], "stag", true)
+end
+
+local function check()
+	local n = 0
+	for v in w:select "value:in svalue:in sobj:in" do
+		assert(v.value == v.svalue)
+		assert(v.sobj == "obj" .. v.value)
+		n = n + 1
+	end
+	local t = 0
+	for v in w:select "value:in stag" do
+		assert(v.value % 2 == 1)
+		t = t + 1
+	end
+	local a = 0
+	for v in w:select "value:in svalue:absent" do
+		assert((N - v.value) % 3 ~= 0)
+		a = a + 1
+	end
+	return n, t, a
+end
+
+local n, t, a = check()
+assert(n == 34 and t == 50 and a == 66)
+
+-- remove some entities, entity index changes
+for v in w:select "value:in" do
+	if v.value % 5 == 0 then
+		w:remove(v)
+	end
+end
+w:update()
+
+local n, t, a = check()
+print(n, t, a)
+assert(w:count "value" == 80)
+
+-- disable tags
+for v in w:select "stag:out value:in" do
+	if v.value % 3 == 0 then
+		v.stag = false
+	end
+end
+
+for v in w:select "value:in stag?in" do
+	if v.stag then
+		assert(v.value % 2 == 1 and v.value % 3 ~= 0)
+	end
+	assert(w:access(v.eid or eids[v.value], "stag") == (v.stag == true))
+end
+
+w:clear "svalue"
+for v in w:select "value:in svalue:absent" do
+	assert(w:access(eids[v.value], "svalue") == nil)
+end
+assert(w:count "svalue" == 0)
+
+print("memory", w:memory())
@@ -0,0 +1,134 @@
+-- struct of arrays layout
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+	"id:int",
+	layout = "soa",
+}
+
+w:register {
+	name = "parent",
+	"eid:int64",
+	"depth:byte",
+	layout = "soa",
+}
+
+w:register {
+	name = "mark",
+}
+
+w:register {
+	name = "visible",
+}
+
+local N = 200
+local root = w:new { visible = true }
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new {
+		vector = { x = i, y = -i, id = i },
+		mark = (i % 3 == 0),
+		parent = (i % 2 == 0) and { eid = root, depth = i % 256 } or nil,
+	}
+end
+
+local function check()
+	local n = 0
+	for e in w:select "vector:in" do
+		n = n + 1
+		local v = e.vector
+		assert(v.x == v.id and v.y == -v.id)
+	end
+	return n
+end
+
+assert(check() == N)
+
+-- write field by alias, and the whole struct
+for e in w:select "mark vector_x:in vector_y:out" do
+	e.vector_y = e.vector_x * 2
+end
+for e in w:select "mark vector:update" do
+	assert(e.vector.y == e.vector.x * 2)
+	e.vector.y = -e.vector.x
+end
+assert(check() == N)
+
+-- raw object access
+local raw = w:object("vector", 1)
+assert(raw.x == 1 and raw.id == 1)
+w:object("vector", 1, { x = 1, y = -1, id = 1 })
+
+-- column api
+local context = w:context { "vector" }
+local test = require "ecs.ctest"
+local s, stride = test.columnsum(context, w:component_id "vector", 0)
+assert(s == N * (N+1) / 2 and stride == 4)
+-- entity_fetch / entity_component are NULL, read the columns instead
+for i = 0, N - 1, 7 do
+	local x, y = test.soaread(context, w:component_id "vector", i)
+	assert(x == i + 1 and y == -(i + 1))
+end
+
+-- remove some and renumber
+for i = 1, N, 5 do
+	w:remove(eids[i])
+end
+w:update()
+assert(check() == N - N // 5)
+
+-- temporary component
+for e in w:select "vector:in" do
+	e.vector.id = e.vector.id
+end
+
+-- template
+local t = w:template {
+	vector = { x = 1000, y = -1000, id = 1000 },
+}
+w:template_instance(w:new(), t)
+assert(check() == N - N // 5 + 1)
+
+-- propagate tag through the first field
+w:propagate("parent", "visible")
+local n = 0
+for e in w:select "visible parent:in" do
+	assert(e.parent.eid == root)
+	n = n + 1
+end
+assert(n > 0)
+
+-- persistence keeps the record format
+local writer = ecs.writer "temp.bin"
+writer:write(w, w:component_id "eid")
+writer:write(w, w:component_id "vector")
+local meta = writer:close()
+
+local w2 = ecs.world()
+w2:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+	"id:int",
+}
+local reader = ecs.reader "temp.bin"
+w2:read_component(reader, "eid", meta[1].offset, meta[1].stride, meta[1].n)
+w2:read_component(reader, "vector", meta[2].offset, meta[2].stride, meta[2].n)
+reader:close()
+
+local sum1, sum2 = 0, 0
+for e in w:select "vector:in" do
+	sum1 = sum1 + e.vector.id
+end
+for e in w2:select "vector:in" do
+	assert(e.vector.x == e.vector.id and e.vector.y == -e.vector.id)
+	sum2 = sum2 + e.vector.id
+end
+assert(sum1 == sum2)
+
+print("OK")
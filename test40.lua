@@ -0,0 +1,96 @@
+-- paged storage
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "value",
+	type = "int",
+}
+
+w:register {
+	name = "pvalue",
+	type = "int",
+	paged = true,
+}
+
+w:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+	paged = true,
+}
+
+local N = 5000
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new { value = i, vector = { x = i, y = -i } }
+end
+
+-- add components out of order, it shifts across the pages
+for i = N, 1, -3 do
+	w:import(eids[i], { pvalue = i })
+end
+
+local function check()
+	local n = 0
+	for e in w:select "value:in pvalue:in" do
+		assert(e.value == e.pvalue)
+		n = n + 1
+	end
+	for e in w:select "value:in vector:in" do
+		assert(e.vector.x == e.value and e.vector.y == -e.value)
+	end
+	return n
+end
+
+local n = check()
+assert(n == (N + 2) // 3)
+
+for i = 1, N, 7 do
+	w:remove(eids[i])
+end
+w:update()
+check()
+
+for e in w:select "value:in vector:out" do
+	e.vector = { x = e.value, y = -e.value }
+end
+check()
+
+print("memory", w:memory())
+
+-- persistence
+local writer = ecs.writer "temp.bin"
+writer:write(w, w:component_id "eid")
+writer:write(w, w:component_id "value")
+writer:write(w, w:component_id "vector")
+local meta = writer:close()
+
+local w2 = ecs.world()
+w2:register {
+	name = "value",
+	type = "int",
+	paged = true,
+}
+w2:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+	paged = true,
+}
+
+local reader = ecs.reader "temp.bin"
+w2:read_component(reader, "eid", meta[1].offset, meta[1].stride, meta[1].n)
+w2:read_component(reader, "value", meta[2].offset, meta[2].stride, meta[2].n)
+w2:read_component(reader, "vector", meta[3].offset, meta[3].stride, meta[3].n)
+reader:close()
+
+local n2 = 0
+for e in w2:select "value:in vector:in" do
+	assert(e.vector.x == e.value and e.vector.y == -e.value)
+	n2 = n2 + 1
+end
+assert(n2 == meta[2].n)
+
+print("OK")
@@ -0,0 +1,103 @@
+-- new entities in batch
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "value",
+	type = "int",
+}
+
+w:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+}
+
+w:register {
+	name = "svector",
+	"x:float",
+	"y:float",
+	layout = "soa",
+	sparse = true,
+}
+
+w:register {
+	name = "pvalue",
+	type = "int",
+	paged = true,
+}
+
+w:register {
+	name = "mark",
+}
+
+w:register {
+	name = "name",
+	type = "lua",
+}
+
+w:new { value = 0 }
+
+local N = 3000
+local eid = w:new_batch(N, {
+	value = 1,
+	vector = { x = 2, y = 3 },
+	svector = { x = 4, y = 5 },
+	pvalue = 6,
+	mark = true,
+	name = "bullet",
+})
+
+local n = 0
+local last
+for e in w:select "mark value:in vector:in svector:in pvalue:in name:in eid:in" do
+	n = n + 1
+	assert(e.value == 1 and e.pvalue == 6 and e.name == "bullet")
+	assert(e.vector.x == 2 and e.vector.y == 3)
+	assert(e.svector.x == 4 and e.svector.y == 5)
+	assert(e.eid == eid + n - 1)
+end
+assert(n == N)
+assert(w:count "value" == N + 1)
+
+-- the entities are independent
+w:access(eid + 1, "value", 42)
+assert(w:access(eid, "value") == 1)
+assert(w:access(eid + 1, "value") == 42)
+
+for i = 0, N - 1, 2 do
+	w:remove(eid + i)
+end
+w:update()
+assert(w:count "mark" == N // 2)
+assert(w:count "svector" == N // 2)
+
+-- batch of one entity works as new
+local e1 = w:new_batch(1, { value = 7 })
+assert(w:access(e1, "value") == 7)
+
+-- nothing is created for an empty or invalid batch
+local count = w:count "value"
+assert(w:new_batch(0, { value = 8 }) == nil)
+assert(not pcall(w.new_batch, w, -1, { value = 8 }))
+assert(not pcall(w.new_batch, w, 1.5, { value = 8 }))
+-- the tables of lua object can't be shared
+assert(not pcall(w.new_batch, w, 2, { value = 8, name = {} }))
+assert(w:count "value" == count)
+
+-- C api
+local context = w:context { "vector", "mark" }
+local test = require "ecs.ctest"
+local first = test.newbatch(context, 100, w:component_id "vector", w:component_id "mark", 10, 20)
+assert(first)
+n = 0
+for e in w:select "mark vector:in value?in" do
+	if e.vector.x == 10 then
+		assert(e.vector.y == 20 and e.value == nil)
+		n = n + 1
+	end
+end
+assert(n == 100)
+
+print("OK")
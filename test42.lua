@@ -0,0 +1,82 @@
+-- add components to old entities, they are staged and merged before reading
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local w = ecs.world()
+
+w:register {
+	name = "value",
+	type = "int",
+}
+
+w:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+}
+
+w:register {
+	name = "name",
+	type = "lua",
+}
+
+local N = 3000
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new { value = i }
+end
+w:new { vector = { x = 0, y = 0 }, name = "last" }
+
+for i = N, 1, -2 do
+	w:import(eids[i], { vector = { x = i, y = -i }, name = "e" .. i })
+end
+
+-- duplicated component
+assert(not pcall(w.import, w, eids[N], { vector = { x = 0, y = 0 } }))
+
+-- the reads from C don't merge them, the staged rows are after the sorted ones
+local ctx = w:context { "vector" }
+local vector = w:component_id "vector"
+local tokens, count = test.tokens(ctx, vector)
+assert(#tokens == N // 2 + 1 and count == #tokens)
+assert(tokens[#tokens] == 1 and tokens[#tokens - 1] == 3)
+assert(w:access(eids[2], "vector").x == 2)
+local tokens2 = test.tokens(ctx, vector)
+for i = 1, #tokens do
+	assert(tokens[i] == tokens2[i])
+end
+
+-- queries see the staged components
+local n = 0
+local last = 0
+for e in w:select "value:in vector:in name:in" do
+	assert(e.value > last)
+	last = e.value
+	assert(e.vector.x == e.value and e.vector.y == -e.value)
+	assert(e.name == "e" .. e.value)
+	n = n + 1
+end
+assert(n == N // 2)
+assert(w:count "vector" == N // 2 + 1)
+-- merged by the query
+tokens = test.tokens(ctx, vector)
+for i = 2, #tokens do
+	assert(tokens[i - 1] < tokens[i])
+end
+
+-- lookup
+w:import(eids[1], { vector = { x = 1, y = -1 } })
+assert(w:access(eids[1], "vector").x == 1)
+
+-- update merges them too
+w:import(eids[3], { vector = { x = 3, y = -3 }, name = "e3" })
+w:remove(eids[2])
+w:update()
+n = 0
+for e in w:select "value:in vector:in" do
+	assert(e.vector.x == e.value)
+	n = n + 1
+end
+assert(n == N // 2 + 1)
+
+print("OK")
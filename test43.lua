@@ -0,0 +1,63 @@
+-- w:update() only touches the pools after the first removed entity
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "old",
+	type = "int",
+}
+
+w:register {
+	name = "new",
+	type = "int",
+	sparse = true,
+}
+
+w:register {
+	name = "mark",
+}
+
+local old = {}
+for i = 1, 10 do
+	old[i] = w:new { old = i }
+end
+local new = {}
+for i = 1, 10 do
+	new[i] = w:new { new = i, mark = (i % 2 == 0) }
+end
+
+w:update_stat(true)
+
+w:remove(new[3])
+w:remove(new[4])
+w:update()
+
+local stat = w:update_stat()
+assert(stat.update == 1)
+-- new and mark
+assert(stat.merge == 2)
+-- old is before the removed entities
+assert(stat.skip >= 1)
+assert(stat.shift == 0)
+
+-- old has nothing after the removed entity, new and mark need to renumber
+w:remove(old[10])
+w:update()
+stat = w:update_stat(true)
+assert(stat.update == 2 and stat.merge == 3 and stat.shift == 2)
+
+-- nothing removed
+w:update()
+assert(w:update_stat().update == 0)
+
+local n = 0
+for e in w:select "new:in eid:in" do
+	n = n + 1
+	assert(w:access(e.eid, "new") == e.new)
+end
+assert(n == 8)
+assert(w:count "mark" == 4)
+assert(w:count "old" == 9)
+
+print("OK")
@@ -0,0 +1,113 @@
+-- stable entity slots
+local ecs = require "ecs"
+
+local w = ecs.world(nil, { stable = true })
+
+w:register {
+	name = "value",
+	type = "int",
+}
+
+w:register {
+	name = "other",
+	type = "int",
+}
+
+w:register {
+	name = "name",
+	type = "lua",
+}
+
+w:register {
+	name = "mark",
+}
+
+local N = 100
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new { value = i, name = "e" .. i, mark = (i % 2 == 0) }
+end
+for i = 1, 10 do
+	w:new { other = i }
+end
+
+w:update_stat(true)
+local removed = {}
+for i = 1, N, 10 do
+	w:remove(eids[i])
+	removed[eids[i]] = true
+end
+w:update()
+
+-- other has no removed entity, it's not touched
+local stat = w:update_stat(true)
+assert(stat.update == 1 and stat.shift == 0)
+
+for i = 1, N do
+	assert(w:exist(eids[i]) == not removed[eids[i]])
+end
+assert(w:count "eid" == N + 10 - N // 10)
+
+-- reuse the free slots, the old eids are still invalid
+local last = eids[N]
+local new = {}
+local newlist = {}
+for i = 1, N // 10 do
+	local eid = w:new { value = -i, name = "new" .. i, mark = true }
+	assert(eid > last)
+	last = eid
+	new[eid] = i
+	newlist[i] = eid
+end
+for eid in pairs(removed) do
+	assert(not w:exist(eid))
+end
+
+local n = 0
+for e in w:select "value:in name:in eid:in" do
+	n = n + 1
+	if new[e.eid] then
+		assert(e.value == -new[e.eid] and e.name == "new" .. new[e.eid])
+	else
+		assert(e.name == "e" .. e.value)
+		assert(eids[e.value] == e.eid)
+	end
+	assert(w:access(e.eid, "value") == e.value)
+end
+assert(n == N)
+assert(w:count "eid" == N + 10)
+
+-- tags, filter and groups work with the slots
+local marks = 0
+for e in w:select "mark value:in" do
+	assert(e.value < 0 or e.value % 2 == 0)
+	marks = marks + 1
+end
+assert(marks == N // 2 + N // 10)
+
+w:filter("mark", "value other:absent")
+assert(w:count "mark" == N)
+
+for _, eid in ipairs(newlist) do
+	w:group_add(1, eid)
+end
+w:group_enable("mark", 1)
+assert(w:count "mark" == N // 10)
+
+-- batch clone of an entity in a reused slot
+local e = newlist[1]
+w:remove(e)
+w:update()
+assert(not w:exist(e))
+w:new_batch(5, { value = 1000, name = "batch" })
+local bn = 0
+for v in w:select "value:in name:in" do
+	if v.value == 1000 then
+		assert(v.name == "batch")
+		bn = bn + 1
+	end
+end
+assert(bn == 5)
+assert(w:count "eid" == N + 10 - 1 + 5)
+
+print("OK")
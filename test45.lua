@@ -0,0 +1,99 @@
+-- allocator hook, aligned components and memory_stat
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local hook, base = test.allochook()
+local w = ecs.world(nil, { alloc = hook })
+
+w:register {
+	name = "vector",
+	"x:float",
+	"y:float",
+	"z:float",
+	align = 64,
+}
+
+w:register {
+	name = "soa",
+	"x:float",
+	"y:float",
+	"id:byte",
+	layout = "soa",
+	align = 32,
+}
+
+w:register {
+	name = "paged",
+	type = "int",
+	paged = true,
+	align = 64,
+}
+
+w:register {
+	name = "value",
+	type = "int",
+	sparse = true,
+}
+
+w:register {
+	name = "name",
+	type = "lua",
+}
+
+w:register {
+	name = "mark",
+}
+
+assert(not pcall(w.register, w, { name = "bad", type = "int", align = 24 }))
+assert(not pcall(w.register, w, { name = "bad2", align = 32 }))
+
+local eids = {}
+for i = 1, 1000 do
+	eids[i] = w:new {
+		vector = { x = i, y = i, z = i },
+		soa = { x = i, y = -i, id = i % 256 },
+		paged = i,
+		value = i,
+		name = "e" .. i,
+		mark = (i % 2 == 0),
+	}
+	w:group_add(i % 3, eids[i])
+end
+
+for i = 1, 1000, 7 do
+	w:remove(eids[i])
+end
+w:update()
+
+local context = w:context { "vector", "soa" }
+local vector = w:component_id "vector"
+local soa = w:component_id "soa"
+assert(test.columnaddr(context, vector, 0) % 64 == 0)
+-- each column is aligned
+assert(test.columnaddr(context, soa, 0) % 32 == 0)
+assert(test.columnaddr(context, soa, 4) % 32 == 0)
+assert(test.columnaddr(context, soa, 8) % 32 == 0)
+local s = test.columnsum(context, soa, 0)
+local n = 0
+for e in w:select "soa:in vector:in paged:in" do
+	assert(e.soa.x == e.vector.x and e.paged == e.vector.x)
+	n = n + e.soa.x
+end
+assert(s == n)
+
+local stat = w:memory_stat()
+assert(stat.component > 0 and stat.tag > 0 and stat.sparse > 0 and stat.eid > 0 and stat.group > 0 and stat.other > 0)
+assert(stat.total == stat.component + stat.tag + stat.sparse + stat.eid + stat.group + stat.other)
+local _, bytes = test.allochook()
+-- the headers are not counted
+assert(bytes - base >= stat.total)
+
+-- all the memory returns to the hook
+w = nil
+context = nil
+collectgarbage()
+collectgarbage()
+local _, bytes = test.allochook()
+assert(bytes == base)
+
+print("OK")
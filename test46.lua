@@ -0,0 +1,90 @@
+-- transient components
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "value",
+	type = "int",
+}
+
+w:register {
+	name = "velocity",
+	"x:float",
+	"y:float",
+	transient = true,
+}
+
+w:register {
+	name = "moved",
+	transient = true,
+}
+
+w:register {
+	name = "event",
+}
+
+w:register {
+	name = "hit",
+	type = "int",
+	transient = true,
+}
+
+assert(not pcall(w.register, w, { name = "bad", type = "lua", transient = true }))
+
+local N = 1000
+for i = 1, N do
+	w:new { value = i }
+end
+
+local last_arena
+for frame = 1, 20 do
+	-- the count fluctuates every frame
+	local m = (frame * 37) % 11 + 1
+	for v in w:select "value:in velocity:new" do
+		if v.value % m == 0 then
+			v.velocity = { x = v.value, y = -v.value }
+		else
+			v.velocity = nil
+		end
+	end
+	local n, even = 0, 0
+	for v in w:select "velocity:in value:in moved?out" do
+		assert(v.velocity.x == v.value and v.velocity.y == -v.value)
+		v.moved = v.value % 2 == 0
+		n = n + 1
+		if v.moved then
+			even = even + 1
+		end
+	end
+	assert(n == N // m)
+	assert(w:count "moved" == even)
+
+	for i = 1, m do
+		w:temporary("event", "hit", i)
+	end
+	local s = 0
+	for v in w:select "hit:in" do
+		s = s + v.hit
+	end
+	assert(s == m * (m + 1) // 2)
+
+	local arena = w:memory_stat().transient
+	assert(arena > 0)
+	if frame > 10 then
+		-- one block after the warm up
+		assert(arena == last_arena)
+	end
+	last_arena = arena
+
+	w:clear_transient()
+	assert(w:count "velocity" == 0 and w:count "moved" == 0 and w:count "hit" == 0)
+	for v in w:select "event" do
+		w:remove(v)
+	end
+	w:update()
+end
+
+assert(w:count "value" == N)
+
+print("OK")
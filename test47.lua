@@ -0,0 +1,126 @@
+-- query planner : drive the iteration from the smallest pool
+local ecs = require "ecs"
+
+local function test(option)
+	local w = ecs.world(nil, option)
+
+	w:register {
+		name = "transform",
+		type = "int",
+	}
+
+	w:register {
+		name = "value",
+		type = "int",
+	}
+
+	w:register {
+		name = "selected",
+	}
+
+	w:register {
+		name = "hidden",
+	}
+
+	local N = 10000
+	local eids = {}
+	for i = 1, N do
+		eids[i] = w:new {
+			transform = i,
+			value = (i % 100 == 0) and i or nil,
+			selected = (i % 300 == 0),
+			hidden = (i % 600 == 0),
+		}
+	end
+
+	local function expect(check)
+		local r = {}
+		for i = 1, N do
+			if check(i) then
+				r[#r+1] = i
+			end
+		end
+		return r
+	end
+
+	-- the driver is chosen from the required keys
+	local _, _, v = w:select "transform:in selected"
+	assert(v[4] == 1)
+	local _, _, v = w:select "transform:in value?in selected"
+	assert(v[4] == 2)
+	local _, _, v = w:select "transform:in hidden:absent"
+	assert(v[4] == nil)
+
+	-- the order is still by entity
+	local r = expect(function(i) return i % 300 == 0 and i % 600 ~= 0 end)
+	local n = 0
+	for e in w:select "transform:in value:in selected hidden:absent eid:in" do
+		n = n + 1
+		assert(e.transform == r[n] and e.value == r[n])
+		assert(e.eid == eids[r[n]])
+	end
+	assert(n == #r)
+	assert(w:count "transform selected hidden:absent" == #r)
+	assert(w:count "selected transform" == N // 300)
+	local e = w:first "transform:in value:in selected:in"
+	assert(e.transform == 300 and e.value == 300 and e.selected)
+
+	-- writes go to the mainkey
+	for e in w:select "transform:update selected" do
+		e.transform = -e.transform
+	end
+	for e in w:select "transform:in" do
+		local i = math.abs(e.transform)
+		assert((i % 300 == 0) == (e.transform < 0))
+	end
+
+	-- remove the driver tag while iterating
+	n = 0
+	for e in w:select "transform:in selected:out value:in" do
+		e.selected = false
+		n = n + 1
+	end
+	assert(n == N // 300)
+	assert(w:count "selected" == 0)
+
+	-- the mainkey is a tag
+	for e in w:select "value:in" do
+		if e.value % 200 == 0 then
+			w:access(eids[e.value], "selected", true)
+		end
+	end
+	n = 0
+	for e in w:select "hidden:out selected value:in" do
+		assert(e.value % 600 == 0 and e.value % 200 == 0)
+		e.hidden = false
+		n = n + 1
+	end
+	assert(n == N // 600)
+	assert(w:count "hidden" == 0)
+
+	-- new components while iterating
+	w:register {
+		name = "mark",
+		type = "int",
+	}
+	for e in w:select "transform:in selected mark:new" do
+		e.mark = -e.transform
+	end
+	n = 0
+	for e in w:select "mark:in transform:in" do
+		assert(e.mark == -e.transform)
+		n = n + 1
+	end
+	assert(n == N // 200)
+
+	-- extend the iterator
+	for e in w:select "transform:in selected" do
+		w:extend(e, "value:in")
+		assert(e.value == math.abs(e.transform))
+	end
+end
+
+test()
+test { stable = true }
+
+print("OK")
@@ -0,0 +1,103 @@
+-- merge join
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local w = ecs.world()
+
+w:register {
+	name = "a",
+	"x:float",
+	"y:float",
+}
+
+w:register {
+	name = "b",
+	type = "int",
+}
+
+w:register {
+	name = "t",
+}
+
+w:register {
+	name = "s",
+	sparse = true,
+}
+
+w:register {
+	name = "u",
+	type = "int",
+}
+
+local N = 20000
+local has = {}
+for i = 1, N do
+	local e = {
+		a = (i % 2 == 0) and { x = i, y = 0 } or nil,
+		b = (i % 3 == 0) and i or nil,
+		t = (i % 5 == 0),
+		s = (i % 7 == 0),
+		u = (i % 1000 == 0) and i or nil,
+	}
+	w:new(e)
+	has[i] = e
+end
+
+local function expect(f)
+	local n, s = 0, 0
+	for i = 1, N do
+		if f(has[i]) then
+			n = n + 1
+			s = s + i
+		end
+	end
+	return n, s
+end
+
+local function check(pat, f)
+	local n, s = 0, 0
+	local last = 0
+	for e in w:select(pat .. " a:in") do
+		assert(e.a.x > last)
+		last = e.a.x
+		n = n + 1
+		s = s + e.a.x
+	end
+	local en, es = expect(f)
+	assert(n == en and s == es, pat)
+	assert(w:count(pat .. " a") == en, pat)
+end
+
+check("b t", function(e) return e.a and e.b and e.t end)
+check("b t:absent s", function(e) return e.a and e.b and not e.t and e.s end)
+check("t s b?in", function(e) return e.a and e.t and e.s end)
+check("u b", function(e) return e.a and e.u and e.b end)
+check("b s:absent u:absent", function(e) return e.a and e.b and not e.s and not e.u end)
+
+-- write through the cursors
+for e in w:select "b:update t a:in" do
+	e.b = -e.b
+end
+for e in w:select "b:in a?in t?in" do
+	assert((e.b < 0) == (e.a ~= nil and e.t == true))
+end
+
+local context = w:context { "a", "b", "t", "s", "u" }
+local a = w:component_id "a"
+local b = w:component_id "b"
+local t = w:component_id "t"
+local s = w:component_id "s"
+local u = w:component_id "u"
+
+local function cjoin(f, ...)
+	local n, sum = test.join(context, ...)
+	local en, es = expect(f)
+	assert(n == en and sum == es)
+end
+
+cjoin(function(e) return e.a end, a)
+cjoin(function(e) return e.a and e.b end, a, b)
+cjoin(function(e) return e.a and e.b and e.t and e.s end, a, t, s, b)
+cjoin(function(e) return e.a and e.u and e.t end, a, u, t)
+
+print("OK")
@@ -0,0 +1,130 @@
+-- query cache
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "transform",
+	type = "int",
+}
+
+w:register {
+	name = "render_obj",
+	type = "int",
+}
+
+w:register {
+	name = "visible",
+}
+
+w:register {
+	name = "mark",
+	type = "int",
+}
+
+local N = 1000
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new {
+		transform = i,
+		render_obj = (i % 2 == 0) and i or nil,
+		visible = (i % 3 == 0),
+	}
+end
+
+local pat = "render_obj:in visible transform:update"
+
+local function run()
+	local n, s = 0, 0
+	for v in w:select(pat) do
+		assert(v.render_obj == math.abs(v.transform))
+		v.transform = -v.transform
+		n = n + 1
+		s = s + v.render_obj
+	end
+	return n, s
+end
+
+local function expect()
+	local n, s = 0, 0
+	for i = 1, N do
+		local e = eids[i]
+		if e and i % 2 == 0 and w:access(e, "visible") then
+			n = n + 1
+			s = s + i
+		end
+	end
+	return n, s
+end
+
+local n, s = run()
+assert(n == N // 6)
+collectgarbage()
+local hit, miss = w:query_stat(pat)
+assert(hit == 0 and miss == 1)
+for _ = 1, 10 do
+	local n2, s2 = run()
+	assert(n2 == n and s2 == s)
+end
+hit, miss = w:query_stat(pat)
+assert(hit == 10 and miss == 1)
+-- count uses the cache too
+assert(w:count(pat) == n)
+hit, miss = w:query_stat(pat)
+assert(hit == 11 and miss == 1)
+
+-- structural changes
+w:access(eids[1], "visible", true)	-- no render_obj
+w:access(eids[2], "visible", true)
+n, s = run()
+assert(n == N // 6 + 1)
+hit, miss = w:query_stat(pat)
+assert(hit == 11 and miss == 2)
+assert(select(2, expect()) == s)
+
+w:remove(eids[6])
+eids[6] = nil
+w:update()
+local en, es = expect()
+n, s = run()
+assert(n == en and s == es)
+run()
+hit, miss = w:query_stat(pat)
+assert(hit == 12 and miss == 3)
+
+-- changes while replaying
+local count = 0
+for v in w:select(pat) do
+	count = count + 1
+	if count == 3 then
+		-- the ones after the current
+		for i = 60, 108, 6 do
+			if eids[i] then
+				w:access(eids[i], "visible", false)
+			end
+		end
+	end
+end
+en, es = expect()
+assert(count == en)
+n, s = run()
+assert(n == en and s == es)
+
+-- new entities
+local e = w:new { transform = 1, render_obj = 1, visible = true }
+n, s = run()
+assert(n == en + 1)
+
+-- temporary components don't change the matches
+local tpat = "render_obj:in visible mark:new"
+for i = 1, 3 do
+	w:clear "mark"
+	for v in w:select(tpat) do
+		v.mark = v.render_obj
+	end
+	assert(w:count "mark" == en + 1)
+end
+local hit, miss = w:query_stat(tpat)
+assert(hit == 2 and miss == 1)
+
+print("OK")
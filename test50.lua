@@ -0,0 +1,158 @@
+-- change detection : select the components written since the last select
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_changed(layout)
+	local w = ecs.world()
+
+	local _, size = w:register {
+		name = "vector2",
+		"x:float",
+		"y:float",
+		changed = true,
+		layout = layout,
+	}
+	-- the versions are not in the struct
+	assert(size == 8)
+
+	w:register {
+		name = "value",
+		type = "int",
+		changed = true,
+	}
+
+	w:register {
+		name = "hp",
+		type = "int",
+	}
+
+	w:register {
+		name = "tag",
+	}
+
+	assert(not pcall(w.select, w, "hp:changed"))
+	assert(not pcall(w.register, w, { name = "bad", changed = true }))
+
+	local N = 100
+	local eids = {}
+	for i = 1, N do
+		eids[i] = w:new {
+			vector2 = { x = i, y = 0 },
+			value = i,
+			hp = i,
+			tag = i % 2 == 0,
+		}
+	end
+
+	local function changed(pat)
+		local r = {}
+		for e in w:select(pat .. " value:in eid:in") do
+			r[#r+1] = e.value
+		end
+		return r
+	end
+
+	-- the first select sees all of them
+	assert(#changed "vector2:changed" == N)
+	assert(#changed "vector2:changed" == 0)
+	assert(w:count "vector2:changed value:in eid:in" == 0)
+
+	-- write via select, only the modified rows are stamped
+	for e in w:select "vector2:update tag value:in" do
+		e.vector2.y = e.value
+	end
+	assert(w:count "vector2:changed value:in eid:in" == N // 2)
+	local r = changed "vector2:changed"
+	assert(#r == N // 2)
+	for _, v in ipairs(r) do
+		assert(v % 2 == 0)
+	end
+	assert(#changed "vector2:changed" == 0)
+
+	-- :update writes back all of them, but only one is modified
+	for e in w:select "vector2:update value:in" do
+		if e.value == 5 then
+			e.vector2.x = -5
+		end
+	end
+	for e in w:select "value:update" do
+		if e.value == 6 then
+			e.value = 6
+		end
+	end
+	r = changed "vector2:changed"
+	assert(#r == 1 and r[1] == 5)
+	assert(#changed "value:changed tag?in" == N)	-- the first select of this pattern
+	for e in w:select "value:update" do
+		if e.value == 6 then
+			e.value = 60
+		end
+	end
+	r = changed "value:changed tag?in"
+	assert(#r == 1 and r[1] == 60)
+	w:access(eids[6], "value", 6)
+	w:access(eids[5], "vector2", { x = 5, y = 5 })
+	assert(#changed "value:changed tag?in" == 1)
+	assert(#changed "vector2:changed" == 1)
+
+	-- write via access
+	w:access(eids[3], "vector2", { x = 0, y = 0 })
+	w:access(eids[5], "value", 50)
+	r = changed "vector2:changed"
+	assert(#r == 1 and r[1] == 3)
+	r = changed "value:changed"
+	assert(#r == N)	-- the first select of this pattern
+	assert(#changed "value:changed" == 0)
+
+	-- write via the entity object
+	local e = w:fetch(eids[7])
+	w:extend(e, "value:out")
+	e.value = 70
+	w:submit(e)
+	r = changed "value:changed"
+	assert(#r == 1 and r[1] == 70)
+
+	-- the writes in a changed select are seen next time
+	for e in w:select "value:in vector2:out tag" do
+		e.vector2 = { x = e.value, y = -e.value }
+	end
+	local n = 0
+	for e in w:select "vector2:changed value:in eid:in" do
+		w:access(e.eid, "vector2", { x = -e.value, y = 0 })
+		n = n + 1
+	end
+	assert(n == N // 2)
+	r = changed "vector2:changed"
+	assert(#r == N // 2)
+	assert(#changed "vector2:changed" == 0)
+
+	-- new entities are changed
+	local new = w:new { vector2 = { x = 0, y = 0 }, value = N + 1 }
+	r = changed "vector2:changed"
+	assert(#r == 1 and r[1] == N + 1)
+
+	-- the changed key isn't the mainkey
+	assert(#changed "hp:in value:changed" == N)
+	assert(#changed "hp:in value:changed" == 0)
+	w:access(eids[42], "value", -42)
+	r = changed "hp:in value:changed"
+	assert(#r == 1 and r[1] == -42)
+
+	-- write in C
+	local ctx = w:context { "vector2" }
+	local id = w:component_id "vector2"
+	test.touch(ctx, id, 9)
+	r = changed "vector2:changed"
+	assert(#r == 1 and r[1] == 10)
+	assert(w:access(eids[10], "vector2").x == -9)
+
+	-- remove
+	w:remove(new)
+	w:update()
+	assert(#changed "vector2:changed" == 0)
+end
+
+test_changed()
+test_changed "soa"
+
+print("OK")
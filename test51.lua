@@ -0,0 +1,122 @@
+-- read / write the matches in columns
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_columns(layout)
+	local w = ecs.world()
+
+	w:register {
+		name = "vector2",
+		"x:float",
+		"y:float",
+		layout = layout,
+	}
+
+	w:register {
+		name = "value",
+		type = "int",
+	}
+
+	w:register {
+		name = "name",
+		type = "lua",
+	}
+
+	w:register {
+		name = "visible",
+	}
+
+	local N = 1000
+	local eids = {}
+	for i = 1, N do
+		eids[i] = w:new {
+			vector2 = { x = i, y = -i },
+			value = (i % 3 == 0) and i or nil,
+			name = "e" .. i,
+			visible = i % 2 == 0,
+		}
+	end
+
+	local t = {}
+	local n = w:columns("vector2:in value?in name:in visible?in eid:in", t)
+	assert(n == N)
+	for i = 1, n do
+		assert(t.vector2.x[i] == i and t.vector2.y[i] == -i)
+		assert(t.value[i] == ((i % 3 == 0) and i or nil))
+		assert(t.name[i] == "e" .. i)
+		assert(t.visible[i] == (i % 2 == 0))
+		assert(t.eid[i] == eids[i])
+	end
+
+	-- the arrays are reused
+	local x = t.vector2.x
+	n = w:columns("vector2:in visible", t)
+	assert(n == N // 2 and t.vector2.x == x)
+	for i = 1, n do
+		assert(x[i] == i * 2)
+	end
+
+	-- write back
+	t = {}
+	n = w:columns("vector2:update value:in", t)
+	assert(n == N // 3)
+	for i = 1, n do
+		t.vector2.x[i] = t.vector2.x[i] + t.value[i]
+	end
+	w:submit_columns("vector2:update value:in", t)
+	for e in w:select "vector2:in value?in" do
+		local i = -e.vector2.y
+		assert(e.vector2.x == (e.value and i * 2 or i))
+	end
+
+	t = { name = {} }
+	n = w:columns("name:out visible", t)
+	for i = 1, n do
+		t.name[i] = "visible"
+	end
+	w:submit_columns("name:out visible", t)
+	assert(w:count "visible" == N // 2)
+	for e in w:select "name:in visible?in" do
+		assert((e.name == "visible") == (e.visible == true))
+	end
+
+	-- the matches are changed
+	w:columns("value:out", t)
+	w:remove(eids[3])
+	w:update()
+	assert(not pcall(w.submit_columns, w, "value:out", t))
+
+	-- packed buffers
+	local buffer = test.buffer(string.rep("\0", N * 4))
+	local ids = test.buffer(string.rep("\0", N * 8))
+	t = { vector2 = { y = buffer }, eid = ids }
+	n = w:columns("vector2:in eid:in", t)
+	assert(n == N - 1)
+	local bytes = test.bytes(buffer)
+	local id_bytes = test.bytes(ids)
+	for i = 1, n do
+		local y = string.unpack("<f", bytes, i * 4 - 3)
+		local eid = string.unpack("<i8", id_bytes, i * 8 - 7)
+		assert(w:access(eid, "vector2").y == y)
+	end
+	assert(not pcall(w.columns, w, "vector2:in", { vector2 = { x = test.buffer "" } }))
+	assert(not pcall(w.columns, w, "name:in", { name = test.buffer(string.rep("\0", N * 8)) }))
+
+	local values = {}
+	for i = 1, n do
+		values[i] = string.pack("<f", i)
+	end
+	t = { vector2 = { y = test.buffer(table.concat(values)) } }
+	assert(w:columns("vector2:out", {}) == n)
+	w:submit_columns("vector2:out", t)
+	local i = 0
+	for e in w:select "vector2:in" do
+		i = i + 1
+		assert(e.vector2.y == i)
+	end
+end
+
+test_columns()
+test_columns "soa"
+
+print("OK")
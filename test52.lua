@@ -0,0 +1,80 @@
+-- joined spans in C
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_span(paged)
+	local w = ecs.world()
+
+	w:register {
+		name = "a",
+		"x:float",
+		"y:float",
+		paged = paged,
+	}
+
+	w:register {
+		name = "b",
+		type = "int",
+	}
+
+	w:register {
+		name = "t",
+	}
+
+	local N = 10000
+	for i = 1, N do
+		w:new {
+			a = { x = i, y = 0 },
+			b = (i <= N // 2 or i % 2 == 0) and i or nil,
+			t = (i % 100 < 50),
+		}
+	end
+
+	local context = w:context { "a", "b", "t" }
+	local a = w:component_id "a"
+	local b = w:component_id "b"
+	local t = w:component_id "t"
+
+	local function check(...)
+		local jn, js = test.join(context, ...)
+		local n, s, span = test.span(context, ...)
+		assert(n == jn and s == js)
+		return n, span
+	end
+
+	local n, span = check(a)
+	assert(n == N)
+	if not paged then
+		assert(span == 1)
+	end
+	n, span = check(a, b)
+	assert(n == N // 2 + N // 4)
+	if not paged then
+		-- the first half is one span, and one span per entity after
+		assert(span == 1 + N // 4)
+	end
+	n, span = check(a, t)
+	assert(n == N // 2)
+	if not paged then
+		assert(span == N // 100 + 1)
+	end
+	check(a, b, t)
+
+	-- the removed entities don't break the runs
+	for e in w:select "b a:in" do
+		if e.a.x % 1000 == 0 then
+			w:remove(e)
+		end
+	end
+	w:update()
+	n, span = check(a, b)
+	assert(n == N // 2 + N // 4 - N // 1000)
+	if not paged then
+		assert(span == 1 + N // 4 - N // 2000)
+	end
+end
+
+test_span()
+test_span(true)
+
+print("OK")
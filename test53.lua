@@ -0,0 +1,59 @@
+-- read only joins in parallel, run it under ThreadSanitizer : make tsan
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_parallel(option)
+	local w = ecs.world(nil, option)
+
+	w:register {
+		name = "a",
+		"x:float",
+		"y:float",
+	}
+
+	w:register {
+		name = "t",
+	}
+
+	w:register {
+		name = "v",
+		type = "int",
+	}
+
+	local N = 20000
+	local eids = {}
+	for i = 1, N do
+		eids[i] = w:new {
+			a = { x = i, y = 0 },
+			t = (i % 3 == 0),
+			v = (i % 5 == 0) and i or nil,
+		}
+	end
+	-- staged components, they are flushed by entity_split
+	for i = 7, N, 7 do
+		if i % 5 ~= 0 then
+			w:import(eids[i], { v = -i })
+		end
+	end
+
+	local count, sum = 0, 0
+	for i = 3, N, 3 do
+		count = count + 1
+		sum = sum + i + ((i % 5 == 0) and i or (i % 7 == 0) and -i or 0)
+	end
+
+	local context = w:context { "a", "t", "v" }
+	local a = w:component_id "a"
+	local t = w:component_id "t"
+	local v = w:component_id "v"
+	for _, n in ipairs { 1, 2, 3, 8 } do
+		local c, s, driver = test.parallel(context, n, a, t, v)
+		assert(c == count and s == sum)
+		assert(driver == 1)
+	end
+end
+
+test_parallel()
+test_parallel { stable = true }
+
+print("OK")
@@ -0,0 +1,98 @@
+-- count by joining the sorted pools
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "a",
+	type = "int",
+}
+
+w:register {
+	name = "b",
+	type = "int",
+	sparse = true,
+}
+
+w:register {
+	name = "t1",
+}
+
+w:register {
+	name = "t2",
+}
+
+w:register {
+	name = "t3",
+}
+
+local N = 5000
+local eids = {}
+for i = 1, N do
+	eids[i] = w:new {
+		a = (i % 2 == 0) and i or nil,
+		b = (i % 3 == 0) and i or nil,
+		t1 = (i % 5 < 2),
+		t2 = (i % 7 == 0),
+		t3 = (i % 11 < 5),
+	}
+end
+
+local patterns = {
+	"t1",
+	"t1 t2",
+	"t2 a",
+	"a t1 t3",
+	"t3 t1:absent",
+	"a b t2:absent",
+	"t1 b?in t3:absent",
+	"b t1 t2 t3",
+	"t2 t3 a:absent b:absent",
+}
+
+local function select_count(pat)
+	local n = 0
+	for _ in w:select(pat) do
+		n = n + 1
+	end
+	return n
+end
+
+local function check()
+	for _, pat in ipairs(patterns) do
+		assert(w:count(pat) == select_count(pat), pat)
+	end
+end
+
+check()
+
+-- the counts are cached
+local pat = "a t1 t3"
+local n = w:count(pat)
+local hit, miss = w:query_stat(pat)
+assert(w:count(pat) == n)
+local hit2, miss2 = w:query_stat(pat)
+assert(hit2 == hit + 1 and miss2 == miss)
+
+-- writes don't change the count
+for e in w:select "a:update" do
+	e.a = -e.a
+end
+assert(w:count(pat) == n)
+assert(select(2, w:query_stat(pat)) == miss)
+
+-- the tags are changed
+for i = 1, N, 13 do
+	w:access(eids[i], "t1", i % 2 == 0)
+	w:access(eids[i], "t3", true)
+end
+check()
+assert(select(2, w:query_stat(pat)) > miss)
+
+for i = 1, N, 17 do
+	w:remove(eids[i])
+end
+w:update()
+check()
+
+print("OK")
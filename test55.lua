@@ -0,0 +1,115 @@
+-- predicates on the fields in pattern
+local ecs = require "ecs"
+
+local function test_pred(layout)
+	local w = ecs.world()
+
+	w:register {
+		name = "hp",
+		type = "int",
+	}
+
+	w:register {
+		name = "pos",
+		"x:float",
+		"y:float",
+		"layer:byte",
+		"visible:bool",
+		layout = layout,
+	}
+
+	w:register {
+		name = "name",
+		type = "lua",
+	}
+
+	w:register {
+		name = "enemy",
+	}
+
+	local N = 1000
+	for i = 1, N do
+		w:new {
+			hp = i % 100,
+			pos = { x = i, y = -i / 2, layer = i % 4, visible = i % 3 == 0 },
+			name = "e" .. i,
+			enemy = i % 2 == 0,
+		}
+	end
+
+	local function check(pat, f)
+		local n = 0
+		for e in w:select(pat .. " pos:in") do
+			assert(f(e.pos.x), pat)
+			n = n + 1
+		end
+		local en = 0
+		for i = 1, N do
+			if f(i) then
+				en = en + 1
+			end
+		end
+		assert(n == en, pat)
+		assert(w:count(pat) == en, pat)
+		return n
+	end
+
+	check("hp[<10]", function(i) return i % 100 < 10 end)
+	check("hp[>=10,<=12]", function(i) return i % 100 >= 10 and i % 100 <= 12 end)
+	check("hp[==0] enemy", function(i) return i % 100 == 0 end)
+	check("hp[~=0] enemy:absent", function(i) return i % 100 ~= 0 and i % 2 == 1 end)
+	check("pos[x>500,layer==1]", function(i) return i > 500 and i % 4 == 1 end)
+	check("pos[y<-100.5]", function(i) return -i / 2 < -100.5 end)
+	check("pos[visible==true] hp[<50]:in", function(i) return i % 3 == 0 and i % 100 < 50 end)
+	check("pos_x[<=3]", function(i) return i <= 3 end)
+
+	-- the values bound at select time
+	for limit = 1, 10 do
+		local en = 0
+		for i = 1, N do
+			if i % 100 < limit and i % 4 == 1 and i > limit * 50.5 and i % 3 == 0 then
+				en = en + 1
+			end
+		end
+		local n = 0
+		local pat = "hp[<?] pos[layer==?,x>?,visible==?]:in"
+		for e in w:select(pat, limit, 1, limit * 50.5, true) do
+			assert(e.pos.x > limit * 50.5 and e.pos.layer == 1 and e.pos.visible)
+			n = n + 1
+		end
+		assert(n == en)
+		assert(w:count(pat, limit, 1, limit * 50.5, true) == en)
+		assert(not w:check(pat, limit, 1, limit * 50.5, true) == (en == 0))
+		local t = {}
+		assert(w:columns(pat, t, limit, 1, limit * 50.5, true) == en)
+	end
+	assert(not pcall(w.count, w, "hp[<?]", 1, 2))
+	assert(not pcall(w.count, w, "hp[<?]", "x"))
+
+	-- the values are read in each iteration, not cached
+	assert(w:count "hp[<1]" == N // 100)
+	for e in w:select "hp:update" do
+		e.hp = e.hp - 1
+	end
+	assert(w:count "hp[<1]" == N // 100 * 2)
+	local e = w:first "hp[<0]:in name:in"
+	assert(e.hp == -1 and e.name == "e100")
+
+	-- write the keys with predicates
+	for e in w:select "hp[<0]:update" do
+		e.hp = 100
+	end
+	assert(w:count "hp[<0]" == 0)
+
+	assert(not pcall(w.select, w, "name[<1]"))
+	assert(not pcall(w.select, w, "enemy[<1]"))
+	assert(not pcall(w.select, w, "pos[z<1]"))
+	assert(not pcall(w.select, w, "pos[x<y]"))
+	assert(not pcall(w.select, w, "pos[<1]"))
+	assert(not pcall(w.select, w, "hp[<1]?in"))
+end
+
+test_pred()
+test_pred "soa"
+
+print("OK")
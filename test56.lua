@@ -0,0 +1,92 @@
+-- iterate several patterns in one scan
+local ecs = require "ecs"
+
+local w = ecs.world()
+
+w:register {
+	name = "pos",
+	"x:float",
+	"y:float",
+}
+
+w:register {
+	name = "vel",
+	"x:float",
+	"y:float",
+}
+
+w:register {
+	name = "hp",
+	type = "int",
+}
+
+w:register {
+	name = "name",
+	type = "lua",
+}
+
+w:register {
+	name = "dead",
+}
+
+local N = 1000
+for i = 1, N do
+	w:new {
+		pos = { x = i, y = 0 },
+		vel = (i % 2 == 0) and { x = 1, y = i } or nil,
+		hp = (i % 3 == 0) and i or nil,
+		name = "e" .. i,
+	}
+end
+
+-- a readonly view and a writable view
+local n = 0
+for r, v in w:select2("vel:in name:in", "pos:update") do
+	assert(r.name == "e" .. math.floor(v.pos.x))
+	v.pos.x = v.pos.x + r.vel.x
+	v.pos.y = r.vel.y
+	n = n + 1
+end
+assert(n == N // 2)
+for e in w:select "pos:in vel?in" do
+	if e.vel then
+		assert(e.pos.y == e.vel.y and e.pos.x == e.vel.y + 1)
+	else
+		assert(e.pos.y == 0)
+	end
+end
+
+-- the entities should match all the patterns
+n = 0
+for a, b, c in w:select2("hp:in", "vel:in", "name:in pos:in") do
+	assert(a.hp % 6 == 0 and b.vel.y == a.hp and c.name == "e" .. a.hp)
+	n = n + 1
+end
+assert(n == N // 6)
+
+-- structural changes in the second pattern
+n = 0
+for a, b in w:select2("hp:update", "pos:in dead?out") do
+	a.hp = -a.hp
+	b.dead = a.hp % 2 == 0
+	n = n + 1
+end
+assert(n == N // 3)
+assert(w:count "dead" == N // 6)
+for e in w:select "hp:in dead?in" do
+	assert(e.hp < 0 and (e.dead == true) == (e.hp % 2 == 0))
+end
+
+-- the tag as the first pattern
+n = 0
+for a, b in w:select2("dead", "hp:update name:out") do
+	b.hp = 0
+	b.name = "dead"
+	n = n + 1
+end
+assert(n == N // 6)
+for e in w:select "dead name:in hp:in" do
+	assert(e.name == "dead" and e.hp == 0)
+end
+
+print("OK")
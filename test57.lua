@@ -0,0 +1,202 @@
+-- tags in bitset
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function new_world(bitset, option)
+	local w = ecs.world(nil, option)
+
+	w:register {
+		name = "a",
+		"x:float",
+		"y:float",
+	}
+
+	w:register {
+		name = "v",
+		type = "int",
+	}
+
+	w:register {
+		name = "visible",
+		bitset = bitset,
+	}
+
+	w:register {
+		name = "selected",
+		bitset = bitset,
+	}
+
+	w:register {
+		name = "hidden",
+	}
+
+	w:register {
+		name = "parent",
+		"eid:int64",
+	}
+
+	return w
+end
+
+local function run(bitset, option)
+	local w = new_world(bitset, option)
+	local result = {}
+	local function log(v)
+		result[#result+1] = v
+	end
+	local N = 3000
+	local eids = {}
+	for i = 1, N do
+		eids[i] = w:new {
+			a = { x = i, y = 0 },
+			v = (i % 3 == 0) and i or nil,
+			visible = (i % 10 < 7),
+			selected = (i % 4 == 0),
+		}
+	end
+	local function check()
+		log(w:count "visible")
+		log(w:count "visible selected")
+		log(w:count "visible selected:absent")
+		log(w:count "a visible v")
+		log(w:count "a visible:absent")
+		local n, s = 0, 0
+		for e in w:select "visible a:in" do
+			n = n + 1
+			s = s + e.a.x
+		end
+		log(n)
+		log(s)
+		n = 0
+		for e in w:select "a:in selected?in" do
+			if e.selected then
+				n = n + e.a.x
+			end
+		end
+		log(n)
+	end
+	check()
+
+	-- disable the main key in the iteration
+	for e in w:select "visible:update a:in" do
+		if e.a.x % 7 == 0 then
+			e.visible = false
+		end
+	end
+	check()
+	for e in w:select "a:in selected?out" do
+		e.selected = (e.a.x % 5 == 0)
+	end
+	check()
+	for i = 1, N, 11 do
+		w:access(eids[i], "visible", not w:access(eids[i], "visible"))
+	end
+	check()
+
+	w:filter("hidden", "selected visible:absent")
+	log(w:count "hidden")
+	w:filter("selected", "visible v")
+	check()
+
+	for i = 1, N, 13 do
+		w:remove(eids[i])
+	end
+	w:update()
+	check()
+
+	-- new entities after the removed ones
+	for i = 1, 100 do
+		eids[#eids+1] = w:new { a = { x = -i, y = 0 }, visible = true, selected = i % 2 == 0 }
+	end
+	w:new_batch(10, { a = { x = 0.5, y = 0 }, visible = true })
+	check()
+
+	-- C api
+	local ctx = w:context { "a", "visible", "selected", "v" }
+	local a = w:component_id "a"
+	local visible = w:component_id "visible"
+	local selected = w:component_id "selected"
+	local v = w:component_id "v"
+	local n, s = test.join(ctx, a, visible)
+	log(n)
+	log(s)
+	n, s = test.join(ctx, a, visible, selected)
+	log(n)
+	log(s)
+	n, s = test.span(ctx, a, visible)
+	log(n)
+	log(s)
+	for _, nw in ipairs { 1, 3 } do
+		n, s = test.parallel(ctx, nw, a, visible, v)
+		log(n)
+		log(s)
+	end
+	assert(test.tag_next(ctx, visible) == w:count "visible")
+	assert(test.tag_next(ctx, selected) == w:count "selected")
+
+	-- propagate
+	w:clear "visible"
+	local root = w:new { a = { x = 0, y = 0 }, visible = true }
+	local last = root
+	for i = 1, 10 do
+		last = w:new { a = { x = 0, y = 0 }, parent = { eid = last } }
+	end
+	w:propagate("parent", "visible")
+	if bitset and not option then
+		-- the parents are visited before the children
+		assert(w:count "visible parent" == 10)
+	end
+
+	-- persistence
+	if not option then
+		local writer = ecs.writer "temp.bin"
+		writer:write(w, w:component_id "eid")
+		writer:write(w, w:component_id "a")
+		writer:write(w, w:component_id "selected")
+		local meta = writer:close()
+		local w2 = new_world(bitset)
+		local reader = ecs.reader "temp.bin"
+		w2:read_component(reader, "eid", meta[1].offset, meta[1].stride, meta[1].n)
+		w2:read_component(reader, "a", meta[2].offset, meta[2].stride, meta[2].n)
+		w2:read_component(reader, "selected", meta[3].offset, meta[3].stride, meta[3].n)
+		reader:close()
+		log(w2:count "a selected")
+		n = 0
+		for e in w2:select "selected a:in" do
+			n = n + e.a.x
+		end
+		log(n)
+		log(#w:dumpid "selected")
+	end
+	return result
+end
+
+for _, option in ipairs { false, { stable = true } } do
+	local r1 = run(false, option or nil)
+	local r2 = run(true, option or nil)
+	assert(#r1 == #r2)
+	for i = 1, #r1 do
+		assert(r1[i] == r2[i], i)
+	end
+end
+
+-- memory
+local function tag_memory(bitset)
+	local w = new_world(bitset)
+	for i = 1, 100000 do
+		w:new { visible = i % 10 < 7 }
+	end
+	return w:memory_stat().tag
+end
+local m1 = tag_memory(false)
+local m2 = tag_memory(true)
+assert(m2 * 10 < m1)
+
+assert(not pcall(function()
+	local w = ecs.world()
+	w:register { name = "bad", type = "int", bitset = true }
+end))
+
+os.remove "temp.bin"
+
+print("OK")
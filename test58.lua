@@ -0,0 +1,114 @@
+-- disable tags without moving the others
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_tag(sparse, option)
+	local w = ecs.world(nil, option)
+
+	w:register {
+		name = "a",
+		"x:float",
+		"y:float",
+	}
+
+	w:register {
+		name = "t",
+		sparse = sparse,
+	}
+
+	local N = 1000
+	local eids = {}
+	local tag = {}
+	for i = 1, N do
+		eids[i] = w:new {
+			a = { x = i, y = 0 },
+			t = true,
+		}
+		tag[i] = true
+	end
+
+	local function check()
+		local n = 0
+		local s = 0
+		for e in w:select "t a:in" do
+			assert(tag[e.a.x])
+			n = n + 1
+			s = s + e.a.x
+		end
+		local en, es = 0, 0
+		for i = 1, N do
+			if tag[i] then
+				en = en + 1
+				es = es + i
+			end
+		end
+		assert(n == en and s == es)
+		assert(w:count "t" == en)
+		assert(w:count "a t" == en)
+		assert(#w:dumpid "t" == en)
+		for i = 1, N, 37 do
+			assert(w:access(eids[i], "t") == (tag[i] == true))
+		end
+		local context = w:context { "a", "t" }
+		n, s = test.join(context, w:component_id "a", w:component_id "t")
+		assert(n == en and s == es)
+		n, s = test.span(context, w:component_id "a", w:component_id "t")
+		assert(n == en and s == es)
+		-- fetch, next and count agree on the disabled tags
+		local fn, cn = test.tag_fetch(context, w:component_id "t")
+		assert(fn == en and cn == en)
+		assert(test.tag_next(context, w:component_id "t") == en)
+	end
+
+	-- disable the main key, and the next ones in iteration
+	for e in w:select "t:update a:in" do
+		local x = e.a.x
+		if x <= N // 2 or x % 3 == 0 then
+			e.t = false
+			tag[x] = nil
+		end
+		if x % 10 == 1 and x + 1 <= N then
+			w:access(eids[x + 1], "t", false)
+			tag[x + 1] = nil
+		end
+	end
+	check()
+
+	-- enable them again
+	for i = 1, N, 4 do
+		w:access(eids[i], "t", true)
+		tag[i] = true
+	end
+	check()
+
+	for e in w:select "a:in t?out" do
+		local x = e.a.x
+		e.t = x % 7 < 3
+		tag[x] = (x % 7 < 3) or nil
+	end
+	check()
+
+	-- the disabled tags are dropped by update
+	w:update()
+	check()
+
+	for i = 1, N, 9 do
+		w:remove(eids[i])
+		tag[i] = nil
+	end
+	w:update()
+	-- x is not the index any more
+	local tags = {}
+	for e in w:select "t a:in" do
+		tags[e.a.x] = true
+	end
+	for i = 1, N do
+		assert(tags[i] == tag[i])
+	end
+end
+
+test_tag()
+test_tag(true)
+test_tag(false, { stable = true })
+
+print("OK")
@@ -0,0 +1,161 @@
+-- union, intersect and subtract of tags
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_op(bitset, sparse, option)
+	local w = ecs.world(nil, option)
+
+	w:register {
+		name = "x",
+		type = "int",
+	}
+
+	w:register {
+		name = "v",
+		type = "int",
+	}
+
+	for _, name in ipairs { "a", "b", "c" } do
+		w:register {
+			name = name,
+			bitset = bitset,
+			sparse = sparse,
+		}
+	end
+
+	w:register {
+		name = "r",
+		sparse = sparse,
+	}
+
+	w:register {
+		name = "rb",
+		bitset = true,
+	}
+
+	local N = 2000
+	local set = { a = {}, b = {}, c = {}, v = {} }
+	for i = 1, N do
+		w:new {
+			x = i,
+			a = i % 2 == 0,
+			b = i % 3 == 0,
+			c = i % 5 < 2,
+			v = (i % 7 == 0) and i or nil,
+		}
+		set.a[i] = i % 2 == 0 or nil
+		set.b[i] = i % 3 == 0 or nil
+		set.c[i] = i % 5 < 2 or nil
+		set.v[i] = i % 7 == 0 or nil
+	end
+	-- disable some tags without update
+	for e in w:select "a:update x:in" do
+		if e.x % 11 == 0 then
+			e.a = false
+			set.a[e.x] = nil
+		end
+	end
+
+	local function check(name, expect)
+		local n = 0
+		for e in w:select(name .. " x:in") do
+			assert(expect[e.x], name)
+			n = n + 1
+		end
+		local en = 0
+		for _ in pairs(expect) do
+			en = en + 1
+		end
+		assert(n == en, name)
+		assert(w:count(name) == en, name)
+		return n
+	end
+
+	local function op(f, ...)
+		local s = {}
+		for i = 1, N do
+			if f(i, ...) then
+				s[i] = true
+			end
+		end
+		return s
+	end
+
+	local function union(i, ...)
+		for _, k in ipairs { ... } do
+			if set[k][i] then return true end
+		end
+	end
+	local function intersect(i, ...)
+		for _, k in ipairs { ... } do
+			if not set[k][i] then return false end
+		end
+		return true
+	end
+	local function subtract(i, k, ...)
+		return set[k][i] and not union(i, ...)
+	end
+
+	for _, dst in ipairs { "r", "rb" } do
+		assert(w:tag_union(dst, "a", "b", "c") == check(dst, op(union, "a", "b", "c")))
+		assert(w:tag_intersect(dst, "a", "b") == check(dst, op(intersect, "a", "b")))
+		assert(w:tag_intersect(dst, "a", "v", "c") == check(dst, op(intersect, "a", "v", "c")))
+		assert(w:tag_subtract(dst, "a", "b", "c") == check(dst, op(subtract, "a", "b", "c")))
+		assert(w:tag_subtract(dst, "v", "a") == check(dst, op(subtract, "v", "a")))
+		assert(w:tag_union(dst, "v") == check(dst, set.v))
+	end
+
+	-- dst is one of the sources
+	w:tag_subtract("a", "a", "c")
+	set.a = op(subtract, "a", "c")
+	check("a", set.a)
+	w:tag_union("b", "c", "b")
+	set.b = op(union, "c", "b")
+	check("b", set.b)
+	w:tag_intersect("c", "c", "c")
+	check("c", set.c)
+	check("a b", op(intersect, "a", "b"))
+	check("a b:absent", op(subtract, "a", "b"))
+
+	-- the result works as a tag
+	w:tag_intersect("r", "b", "v")
+	set.r = op(intersect, "b", "v")
+	for e in w:select "r:update x:in" do
+		if e.x % 2 == 0 then
+			e.r = false
+			set.r[e.x] = nil
+		end
+	end
+	w:update()
+	check("r", set.r)
+	local ctx = w:context { "x", "r" }
+	local n = test.join(ctx, w:component_id "x", w:component_id "r")
+	assert(n == check("r", set.r))
+
+	-- remove entities, the sets are renumbered
+	for e in w:select "x:in" do
+		if e.x % 13 == 0 then
+			w:remove(e)
+			for _, s in pairs(set) do
+				s[e.x] = nil
+			end
+		end
+	end
+	w:update()
+	w:tag_union("rb", "a", "b")
+	check("rb", op(union, "a", "b"))
+
+	-- C api
+	local a, b, c, r = w:component_id "a", w:component_id "b", w:component_id "c", w:component_id "r"
+	assert(test.tag_op(ctx, 1, r, a, b) == check("r", op(intersect, "a", "b")))
+	assert(not pcall(w.tag_union, w, "x", "a"))
+	assert(not pcall(w.tag_union, w, "r"))
+end
+
+test_op()
+test_op(false, true)
+test_op(true)
+test_op(false, false, { stable = true })
+test_op(true, false, { stable = true })
+
+print("OK")
@@ -0,0 +1,177 @@
+-- propagate tags down all the levels of a hierarchy
+local ecs = require "ecs"
+local test = require "ecs.ctest"
+
+local function test_tree(bitset, option)
+	local w = ecs.world(nil, option)
+
+	w:register {
+		name = "node",
+		"parent:int64",
+		"x:float",
+		"world:float",
+	}
+
+	w:register {
+		name = "id",
+		type = "int",
+	}
+
+	w:register {
+		name = "visible",
+		bitset = bitset,
+	}
+
+	-- an entity without node is the parent of some roots
+	local scene = w:new { id = 0, visible = true }
+	-- the scene in parent[], its eid may be equal to a row
+	local SCENE = {}
+
+	local N = 1000
+	local eids = {}
+	local parent = {}
+	for i = 1, N do
+		local p
+		if i % 50 == 1 then
+			p = i % 100 == 1 and SCENE or nil
+		else
+			p = (i * 7) % (i - 1) + 1
+		end
+		parent[i] = p
+		eids[i] = w:new {
+			id = i,
+			node = { parent = 0, x = i, world = 0 },
+			visible = (i % 100 == 51) or nil,
+		}
+	end
+	-- a cycle
+	parent[N-1] = N
+	parent[N] = N-1
+	for e in w:select "node:update id:in" do
+		local p = parent[e.id]
+		if p == SCENE then
+			e.node.parent = scene
+		elseif p then
+			e.node.parent = eids[p]
+		end
+	end
+
+	local function expect()
+		local set = {}
+		local function visible(i)
+			if set[i] ~= nil then
+				return set[i]
+			end
+			set[i] = false	-- for the cycle
+			local p = parent[i]
+			local r
+			if p == SCENE then
+				r = true
+			elseif p then
+				r = visible(p)
+			else
+				r = false
+			end
+			set[i] = r
+			return r
+		end
+		for e in w:select "visible id:in" do
+			set[e.id] = true
+		end
+		for i = 1, N do
+			visible(i)
+		end
+		return set
+	end
+
+	local function check(set)
+		local n = 0
+		for e in w:select "visible id:in" do
+			assert(e.id == 0 or set[e.id], e.id)
+			n = n + 1
+		end
+		local en = 1
+		for i = 1, N do
+			if set[i] then
+				en = en + 1
+			end
+		end
+		assert(n == en)
+		return n
+	end
+
+	local set = expect()
+	local before = w:count "visible"
+	local added = w:propagate_all("node", "visible")
+	assert(before + added == check(set))
+	assert(not set[N] and not set[N-1])
+	-- propagate again, nothing changes
+	assert(w:propagate_all("node", "visible") == 0)
+
+	-- world transform
+	local ctx = w:context { "node" }
+	local node = w:component_id "node"
+	assert(test.transform(ctx, node) == N - 2)
+	local x = {}
+	for e in w:select "node:in id:in" do
+		x[e.id] = e.node.world
+	end
+	for i = 1, N - 2 do
+		local s = 0
+		local p = i
+		while p and p ~= SCENE do
+			s = s + p
+			p = parent[p]
+		end
+		assert(x[i] == s)
+	end
+
+	local function clear()
+		for e in w:select "visible:update id:in" do
+			if e.id ~= 0 then
+				e.visible = false
+			end
+		end
+		w:update()
+	end
+
+	-- the parents are changed by writing, clear the tags and propagate from a new root
+	clear()
+	parent[2] = nil
+	for e in w:select "node:update id:in visible?out" do
+		if e.id == 2 then
+			e.node.parent = 0
+			e.visible = true
+		end
+	end
+	set = expect()
+	w:propagate_all("node", "visible")
+	check(set)
+
+	-- remove a subtree root, the children become roots
+	w:remove(eids[2])
+	w:update()
+	for i = 1, N do
+		if parent[i] == 2 then
+			parent[i] = nil
+		end
+	end
+	clear()
+	for e in w:select "node:in id:in visible?out" do
+		if parent[e.id] == nil then
+			e.visible = e.id % 3 == 0
+		end
+	end
+	set = expect()
+	w:propagate_all("node", "visible")
+	check(set)
+
+	assert(not pcall(w.propagate_all, w, "id", "visible"))
+	assert(not pcall(w.propagate_all, w, "node", "id"))
+end
+
+test_tree()
+test_tree(true)
+test_tree(false, { stable = true })
+
+print("OK")